@@ -11,6 +11,9 @@ define BEAGLEBONE_AUTO_BUILD_CMDS
 	# Biên dịch app.c
 	$(TARGET_CC) $(APP_CFLAGS) -o $(@D)/app $(@D)/app.c $(APP_LDFLAGS)
 
+	# Công cụ đo hiệu năng driver
+	$(TARGET_CC) $(APP_CFLAGS) -o $(@D)/sensor_bench $(@D)/sensor_bench.c -lm
+
 	# Biên dịch driver kernel
 	$(MAKE) -C $(LINUX_DIR) M=$(@D) ARCH=$(KERNEL_ARCH) CROSS_COMPILE=$(TARGET_CROSS) modules
 endef
@@ -18,11 +21,14 @@ endef
 define BEAGLEBONE_AUTO_INSTALL_TARGET_CMDS
 	# Cài app vào rootfs
 	$(INSTALL) -D -m 0755 $(@D)/app $(TARGET_DIR)/usr/bin/app
+	$(INSTALL) -D -m 0755 $(@D)/sensor_bench $(TARGET_DIR)/usr/bin/sensor_bench
 
 	# Cài các driver kernel
+	$(INSTALL) -D -m 0755 $(@D)/gpio1_core.ko $(TARGET_DIR)/lib/modules/$(LINUX_VERSION)/gpio1_core.ko
 	$(INSTALL) -D -m 0755 $(@D)/bh1750_1.ko $(TARGET_DIR)/lib/modules/$(LINUX_VERSION)/bh1750_1.ko
 	$(INSTALL) -D -m 0755 $(@D)/led.ko     $(TARGET_DIR)/lib/modules/$(LINUX_VERSION)/led.ko
 	$(INSTALL) -D -m 0755 $(@D)/dht11.ko   $(TARGET_DIR)/lib/modules/$(LINUX_VERSION)/dht11.ko
+	$(INSTALL) -D -m 0755 $(@D)/sensorhub.ko $(TARGET_DIR)/lib/modules/$(LINUX_VERSION)/sensorhub.ko
 
 	# Cài script khởi động
 	$(INSTALL) -D -m 0755 $(@D)/S99beaglebone $(TARGET_DIR)/etc/init.d/S99beaglebone
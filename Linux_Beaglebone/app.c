@@ -12,19 +12,23 @@
 #include <sys/ioctl.h>
 #include <signal.h>
 #include <sys/resource.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <poll.h>
+#include <dht11.h>
+#include <led.h>
+#include <sensorhub.h>
 
 /* Khung định nghĩa */
 #define DHT11_DEVICE_PATH "/dev/dht11"
+#define DHT11_INTERVAL_PARAM "/sys/module/dht11/parameters/sample_interval_ms"
 #define BH1750_DEVICE_PATH "/dev/bh1750"
 #define LED_DEVICE_PATH "/dev/led"   /* Đọc trạng thái từ /dev/led */
+#define SENSORHUB_DEVICE_PATH "/dev/sensorhub"
 #define LOG_FILE "/var/log/system.log"
 #define WATCHDOG_DEVICE "/dev/watchdog"
 
 #define BUFFER_SIZE 128
-#define MAX_RETRIES 3
 
 /* MQTT configuration */
 #define MQTT_BROKER "192.168.6.1"
@@ -33,10 +37,13 @@
 #define MQTT_QOS 1
 #define MQTT_USER "toan"
 #define MQTT_PASS "1"
+#define DEVICE_ID_DEFAULT "bbb"  /* Dùng khi không lấy được hostname */
+#define DEVICE_ID_LEN 64
 
 /* Topic: dữ liệu cảm biến gửi lên và lệnh LED nhận xuống */
 #define MQTT_SENSOR_TOPIC "bbb/sensors"  /* Gửi dữ liệu: temperature, humidity, lux */
 #define MQTT_LED_TOPIC "bbb/led"           /* Nhận lệnh điều khiển LED (JSON có "led1" và "led2") */
+#define MQTT_RULES_TOPIC "bbb/rules"       /* Nhận cấu hình rule ngưỡng (JSON có mảng "rules") */
 
 #define BLINK_INTERVAL 200000     /* 0.2 giây */
 #define RECONNECT_INTERVAL 5      /* Giây */
@@ -45,23 +52,76 @@
 #define LOG_STATUS_INTERVAL 300   /* 5 phút */
 
 /* Các macro bổ sung */
-#define IO_TIMEOUT_SECONDS 2      /* I/O timeout */
 #define DHT11_MAX_FAILS 5         /* Ngưỡng lỗi DHT11 */
-#define DHT11_THREAD_TIMEOUT 10   /* Timeout thread DHT11 */
+#define DHT11_THREAD_TIMEOUT 10   /* Timeout thread DHT11 tối thiểu (giây) */
+#define DHT11_POLL_TIMEOUT_MS 5000 /* Driver lấy mẫu mỗi 2 s, chờ tối đa 5 s */
+#define DHT11_STALE_US 15000000LL  /* Mẫu tốt gần nhất cũ hơn 15 s thì tính là lỗi */
+
+/* Rule engine */
+#define MAX_RULES 8
+#define RULE_ID_LEN 16
 
 /* Nếu muốn sử dụng watchdog, đặt =1 */
 static int use_watchdog = 1;
 static volatile sig_atomic_t running = 1;
 static volatile sig_atomic_t dht11_enabled = 1;
+/* Monitor yêu cầu thread DHT11 tự thoát để khởi động lại (không pthread_cancel) */
+static volatile sig_atomic_t dht11_stop = 0;
+static int dht11_thread_started = 0;   /* dht11_thread còn phải pthread_join */
 static int dht11_fail_count = 0;
 static volatile time_t last_loop_time = 0;
 static volatile time_t last_dht11_time = 0;
 static float last_temp = 0.0, last_humid = 0.0;
-static pthread_t dht11_thread, monitor_thread;
+
+/* Dấu thời gian lấy mẫu do driver cấp (µs, CLOCK_REALTIME) và số thứ tự mẫu */
+struct sensor_stamp {
+    long long acq_us;
+    unsigned int seq;
+};
+static struct sensor_stamp last_dht11_stamp;
+static pthread_t dht11_thread, monitor_thread, led_watch_thread;
 static pthread_mutex_t dht11_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Biến LED2: Nếu led2_blinking = 1 thì LED2 đang ở chế độ nháy liên tục */
 static volatile int led2_blinking = 0;
+/* Trạng thái LED1 (lệnh MQTT hoặc rule), gửi kèm dữ liệu cảm biến */
+static volatile int led1_on = 0;
+/* LED2 bật cố định bởi rule action "on" (khác với nháy) */
+static volatile int led2_on = 0;
+/* Tên thiết bị gửi kèm dữ liệu cảm biến để backend phân biệt nhiều board */
+static char device_id[DEVICE_ID_LEN] = DEVICE_ID_DEFAULT;
+/* Kết nối MQTT cho thread theo dõi LED, NULL khi chưa kết nối */
+static struct mosquitto *volatile led_watch_mosq = NULL;
+
+/* Một mẫu cảm biến đưa vào rule engine; valid cho biết trường nào có giá trị */
+#define SAMPLE_TEMP  (1 << 0)
+#define SAMPLE_HUMID (1 << 1)
+#define SAMPLE_LUX   (1 << 2)
+struct sample {
+    float temperature;
+    float humidity;
+    float lux;
+    unsigned int valid;
+    struct timespec taken;   /* CLOCK_MONOTONIC lúc đọc xong từ driver */
+};
+
+/* Rule ngưỡng có hysteresis: bật khi vượt on_level, chỉ nhả khi quay về off_level */
+enum rule_action { RULE_ACTION_ON, RULE_ACTION_BLINK };
+struct rule {
+    char id[RULE_ID_LEN];
+    unsigned int sensor;     /* SAMPLE_TEMP / SAMPLE_HUMID / SAMPLE_LUX */
+    char op;                 /* '>' hoặc '<' */
+    float on_level;
+    float off_level;
+    int led;                 /* 1 hoặc 2 */
+    enum rule_action action;
+    int active;
+};
+static struct rule rules[MAX_RULES];
+static int rule_count = 0;
+static pthread_mutex_t rules_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void rules_evaluate(const struct sample *s);
 
 
 void log_data(const char *message) {
@@ -112,7 +172,14 @@ static int check_device(const char *path) {
 }
 
 /* --------------------- BH1750 --------------------- */
-int read_bh1750(unsigned int *lux) {
+/* Thời gian thực (µs) dùng cho các mốc trace gửi kèm dữ liệu */
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int read_bh1750(unsigned int *lux, struct sensor_stamp *stamp) {
     int fd = open(BH1750_DEVICE_PATH, O_RDONLY);  /* Blocking read */
     if(fd < 0) {
         log_data("BH1750: Failed to open device");
@@ -132,11 +199,16 @@ int read_bh1750(unsigned int *lux) {
         snprintf(raw_data, sizeof(raw_data), "BH1750: Raw data: '%s'", buffer);
         log_data(raw_data);
     }
-    if(sscanf(buffer, "%u", lux)!=1) {
+    /* Driver gửi "<lux> <timestamp_ns> <seq>", driver cũ chỉ gửi "<lux>" */
+    unsigned long long ts_ns = 0;
+    unsigned int seq = 0;
+    if(sscanf(buffer, "%u %llu %u", lux, &ts_ns, &seq) < 1) {
         log_data("BH1750: Failed to parse lux value");
         close(fd);
         return -1;
     }
+    stamp->acq_us = (long long)(ts_ns / 1000);
+    stamp->seq = seq;
     close(fd);
     log_data("BH1750: Read successful");
     printf("BH1750: Light value = %u lux\n", *lux);
@@ -144,49 +216,44 @@ int read_bh1750(unsigned int *lux) {
     return 0;
 }
 
-/* --------------------- LED STATUS --------------------- */
-int read_led_status(char *status, size_t max_len) {
-    int fd = open(LED_DEVICE_PATH, O_RDONLY);
-    if(fd < 0) {
-        log_data("LED: Failed to open device for reading status");
+/* --------------------- SENSORHUB --------------------- */
+/*
+ * Nếu driver sensorhub được nạp, mỗi chu kỳ chỉ cần một ioctl: driver kích
+ * DHT11 và BH1750 đo cùng lúc rồi trả về một snapshot gồm cả trạng thái LED,
+ * mỗi trường có mốc thời gian riêng. Không có /dev/sensorhub thì main loop
+ * dùng đường cũ (giá trị cache của thread DHT11 + read_bh1750()).
+ */
+static int sensorhub_fd = -1;
+
+int read_sensorhub(struct sensorhub_snapshot *snap) {
+    if(sensorhub_fd < 0)
         return -1;
-    }
-    ssize_t ret = read(fd, status, max_len-1);
-    if(ret < 0) {
-        log_data("LED: Failed to read device status");
-        close(fd);
+    if(ioctl(sensorhub_fd, SENSORHUB_IOC_ACQUIRE, snap) < 0) {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, sizeof(msg), "SENSORHUB: Acquire failed: %s", strerror(errno));
+        log_data(msg);
         return -1;
     }
-    status[ret] = '\0';
-    size_t len = strlen(status);
-    while(len > 0 && (status[len-1]=='\n' || status[len-1]=='\r' || status[len-1] < 32)) {
-        status[len-1] = '\0';
-        len--;
-    }
-    close(fd);
     return 0;
 }
 
 /* --------------------- DHT11 --------------------- */
+/*
+ * Driver tự lấy mẫu nền (sample_interval_ms) và giữ giá trị mới nhất:
+ * thread chỉ cần mở device một lần, poll() chờ mẫu mới rồi đọc một
+ * struct dht11_record (định dạng nhị phân, không cần sscanf).
+ */
 void *dht11_thread_func(void *arg) {
     float temp, humid;
     int fd = -1;
-    char buffer[BUFFER_SIZE];
+    unsigned int format = DHT11_FORMAT_BINARY;
+    struct dht11_record rec;
     ssize_t bytes_read;
-    int retries;
+    struct sample smp;
+    struct pollfd pfd;
     
-    while(running && dht11_enabled) {
-        retries = 0;
-        log_data("DHT11: Starting communication");
-        if(check_device(DHT11_DEVICE_PATH)!=0) {
-            log_data("DHT11: Device check failed");
-            pthread_mutex_lock(&dht11_mutex);
-            dht11_fail_count++;
-            pthread_mutex_unlock(&dht11_mutex);
-            sleep(1);
-            continue;
-        }
-        while(retries < MAX_RETRIES && running && dht11_enabled) {
+    while(running && dht11_enabled && !dht11_stop) {
+        if(fd < 0) {
             fd = open(DHT11_DEVICE_PATH, O_RDONLY | O_NONBLOCK);
             if(fd < 0) {
                 fprintf(stderr, "DHT11: Failed to open device: %s\n", strerror(errno));
@@ -195,96 +262,106 @@ void *dht11_thread_func(void *arg) {
                 dht11_fail_count++;
                 pthread_mutex_unlock(&dht11_mutex);
                 sleep(1);
-                break;
+                continue;
             }
-            struct timeval timeout;
-            fd_set read_fds;
-            FD_ZERO(&read_fds);
-            FD_SET(fd, &read_fds);
-            timeout.tv_sec = IO_TIMEOUT_SECONDS;
-            timeout.tv_usec = 0;
-            int ret_sel = select(fd+1, &read_fds, NULL, NULL, &timeout);
-            if(ret_sel <= 0) {
-                fprintf(stderr, "DHT11: Select timeout or error: %s\n", ret_sel==0 ? "Timeout" : strerror(errno));
-                log_data("DHT11: Select timeout or error");
+            if(ioctl(fd, DHT11_IOC_SET_FORMAT, &format) < 0) {
+                fprintf(stderr, "DHT11: Failed to select binary format: %s\n", strerror(errno));
+                log_data("DHT11: Failed to select binary format");
                 close(fd);
-                retries++;
-                pthread_mutex_lock(&dht11_mutex);
-                dht11_fail_count++;
-                pthread_mutex_unlock(&dht11_mutex);
-                usleep(100000);
+                fd = -1;
+                sleep(1);
                 continue;
             }
-            memset(buffer, 0, sizeof(buffer));
-            bytes_read = read(fd, buffer, sizeof(buffer)-1);
-            if(bytes_read < 0) {
-                fprintf(stderr, "DHT11: Failed to read device: %s\n", strerror(errno));
-                log_data("DHT11: Failed to read device");
-                close(fd);
-                retries++;
+        }
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        int ret_poll = poll(&pfd, 1, DHT11_POLL_TIMEOUT_MS);
+        if(ret_poll <= 0) {
+            if(ret_poll < 0 && errno == EINTR)
+                continue;
+            fprintf(stderr, "DHT11: No new sample: %s\n", ret_poll==0 ? "Timeout" : strerror(errno));
+            log_data("DHT11: No new sample");
+            /* Timeout chưa chắc là lỗi (sample_interval_ms có thể dài hơn):
+             * chỉ tính lỗi khi mẫu tốt gần nhất đã quá cũ */
+            pthread_mutex_lock(&dht11_mutex);
+            if(!last_dht11_stamp.seq || now_us() - last_dht11_stamp.acq_us > DHT11_STALE_US)
+                dht11_fail_count++;
+            pthread_mutex_unlock(&dht11_mutex);
+        } else {
+            bytes_read = read(fd, &rec, sizeof(rec));
+            clock_gettime(CLOCK_MONOTONIC, &smp.taken);
+            if(bytes_read != (ssize_t)sizeof(rec) || rec.seq == 0) {
+                /* Driver chưa có mẫu hợp lệ nào, rec.error là lỗi của lần đo gần nhất */
+                char msg[BUFFER_SIZE];
+                snprintf(msg, sizeof(msg), "DHT11: No valid sample (read %zd, error %d)",
+                         bytes_read, bytes_read == (ssize_t)sizeof(rec) ? rec.error : -errno);
+                log_data(msg);
                 pthread_mutex_lock(&dht11_mutex);
                 dht11_fail_count++;
                 pthread_mutex_unlock(&dht11_mutex);
-                usleep(100000);
-                continue;
-            }
-            buffer[bytes_read] = '\0';
-            {
-                char raw_data[BUFFER_SIZE];
-                snprintf(raw_data, sizeof(raw_data), "DHT11: Raw data: '%s'", buffer);
-                log_data(raw_data);
-            }
-            int temp_int, humid_int;
-            if(sscanf(buffer, "Temp: %dC, Hum: %d%%", &temp_int, &humid_int) != 2) {
-                fprintf(stderr, "DHT11: Failed to parse data: '%s' (bytes read: %zd)\n", buffer, bytes_read);
-                snprintf(buffer, sizeof(buffer), "DHT11: Failed to parse data: '%s'", buffer);
-                log_data(buffer);
-                close(fd);
-                retries++;
+            } else {
+                temp = rec.temp_decicelsius / 10.0f;
+                humid = rec.hum_decipercent / 10.0f;
                 pthread_mutex_lock(&dht11_mutex);
-                dht11_fail_count++;
+                last_temp = temp;
+                last_humid = humid;
+                last_dht11_stamp.acq_us = (long long)(rec.timestamp_ns / 1000);
+                last_dht11_stamp.seq = rec.seq;
+                dht11_fail_count = 0;
+                last_dht11_time = time(NULL);
                 pthread_mutex_unlock(&dht11_mutex);
-                usleep(100000);
-                continue;
+                /* Đánh giá rule ngay khi có mẫu mới, không chờ vòng lặp main */
+                smp.temperature = temp;
+                smp.humidity = humid;
+                smp.valid = SAMPLE_TEMP | SAMPLE_HUMID;
+                rules_evaluate(&smp);
             }
-            temp = (float)temp_int;
-            humid = (float)humid_int;
-            close(fd);
-            log_data("DHT11: Read successful");
-            pthread_mutex_lock(&dht11_mutex);
-            last_temp = temp;
-            last_humid = humid;
-            dht11_fail_count = 0;
-            last_dht11_time = time(NULL);
-            pthread_mutex_unlock(&dht11_mutex);
-            break;
-        }
-        if(retries >= MAX_RETRIES) {
-            log_data("DHT11: Failed to read after retries");
-            pthread_mutex_lock(&dht11_mutex);
-            dht11_fail_count++;
-            pthread_mutex_unlock(&dht11_mutex);
         }
         if(dht11_fail_count >= DHT11_MAX_FAILS) {
             log_data("DHT11: Disabled due to excessive failures");
             dht11_enabled = 0;
         }
-        sleep(3);
     }
     if(fd >= 0) close(fd);
     return NULL;
 }
 
+/*
+ * Số giây không có mẫu DHT11 tốt trước khi coi thread là treo: ba chu kỳ lấy
+ * mẫu của driver cộng một lần chờ poll, không dưới DHT11_THREAD_TIMEOUT.
+ */
+static int dht11_stale_after(void) {
+    unsigned int interval_ms = 0;
+    int timeout;
+    FILE *fp = fopen(DHT11_INTERVAL_PARAM, "r");
+
+    if(fp) {
+        if(fscanf(fp, "%u", &interval_ms) != 1)
+            interval_ms = 0;
+        fclose(fp);
+    }
+    timeout = (int)((3ULL * interval_ms + DHT11_POLL_TIMEOUT_MS) / 1000);
+    return timeout > DHT11_THREAD_TIMEOUT ? timeout : DHT11_THREAD_TIMEOUT;
+}
+
 void *monitor_thread_func(void *arg) {
     while(running) {
         time_t now = time(NULL);
         if(now - last_loop_time > 5)
             log_data("Monitor: Main loop appears to be stuck");
-        if(dht11_enabled && now - last_dht11_time > DHT11_THREAD_TIMEOUT) {
+        if(dht11_enabled && now - last_dht11_time > dht11_stale_after()) {
             log_data("Monitor: DHT11 thread appears to be stuck, restarting");
-            pthread_cancel(dht11_thread);
+            /* Thread tự đóng fd và thoát sau tối đa một lần chờ poll */
+            dht11_stop = 1;
             pthread_join(dht11_thread, NULL);
-            if(pthread_create(&dht11_thread, NULL, dht11_thread_func, NULL) != 0)
+            dht11_thread_started = 0;
+            dht11_stop = 0;
+            last_dht11_time = time(NULL);
+            if(!running)
+                break;
+            if(pthread_create(&dht11_thread, NULL, dht11_thread_func, NULL) == 0)
+                dht11_thread_started = 1;
+            else
                 log_data("Monitor: Failed to restart DHT11 thread");
         }
         sleep(2);
@@ -347,7 +424,8 @@ void disable_watchdog(int watchdog_fd) {
 /* --------------------- LED CONTROL --------------------- */
 int set_led_state(int led_num, int state) {
     int fd = -1;
-    char buffer[16];
+    char buffer[64];
+    struct led_batch batch;
     log_data("LED: Attempting to set state");
     if(check_device(LED_DEVICE_PATH) != 0) {
         log_data("LED: Device check failed");
@@ -359,8 +437,10 @@ int set_led_state(int led_num, int state) {
         log_data("LED: Failed to open device");
         return -1;
     }
-    sprintf(buffer, "%d:%d", led_num, state);
-    if(write(fd, buffer, strlen(buffer)) < 0) {
+    /* SETDATAOUT/CLEARDATAOUT trong driver: không đè chân của driver khác */
+    batch.mask = LED_BIT(led_num);
+    batch.value = state ? LED_BIT(led_num) : 0;
+    if(ioctl(fd, LED_IOC_SET, &batch) < 0) {
         fprintf(stderr, "LED: Failed to control LED %d: %s\n", led_num, strerror(errno));
         snprintf(buffer, sizeof(buffer), "LED: Failed to control LED %d", led_num);
         log_data(buffer);
@@ -436,6 +516,246 @@ int publish_led_status(struct mosquitto *mosq, int led_num, const char *state) {
     return 0;
 }
 
+/* --------------------- LED WATCH --------------------- */
+/*
+ * Driver LED tăng generation mỗi khi trạng thái đổi, dù ai ghi (app, rule,
+ * echo vào /dev/led...). Thread này poll() /dev/led và chỉ publish
+ * status/led/N khi LED đó thật sự đổi. LED2 đang nháy thì không publish từng
+ * lần bật/tắt (5 message mỗi giây) mà publish "1" khi bắt đầu nháy và "0"
+ * khi ngừng, kể cả khi lần tắt cuối không làm driver đổi trạng thái.
+ */
+void *led_watch_thread_func(void *arg) {
+    char buffer[BUFFER_SIZE];
+    struct led_event ev;
+    struct pollfd pfd;
+    unsigned int last_state = 0;
+    int have_state = 0;
+    int led2_reported = -1;   /* Giá trị LED2 đã publish gần nhất, -1: chưa có */
+    int blinking;
+    int fd = open(LED_DEVICE_PATH, O_RDONLY | O_NONBLOCK);
+
+    if(fd < 0) {
+        fprintf(stderr, "LED: Failed to open device for watching: %s\n", strerror(errno));
+        log_data("LED: Failed to open device for watching");
+        return NULL;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while(running) {
+        /* Timeout để kiểm tra lại cờ running và trạng thái nháy của LED2 */
+        int ret_poll = poll(&pfd, 1, 1000);
+        blinking = led2_blinking;
+        if(blinking && led2_reported != 1) {
+            if(led_watch_mosq && publish_led_status(led_watch_mosq, 2, "1") == 0)
+                led2_reported = 1;
+        } else if(!blinking && led2_reported == 1 && !(last_state & LED2)) {
+            /* Ngừng nháy khi LED2 đang tắt: driver không báo sự kiện nào */
+            if(led_watch_mosq && publish_led_status(led_watch_mosq, 2, "0") == 0)
+                led2_reported = 0;
+        }
+        if(ret_poll <= 0)
+            continue;
+        if(ioctl(fd, LED_IOC_GET_EVENT, &ev) < 0) {
+            log_data("LED: Failed to read state change");
+            sleep(1);
+            continue;
+        }
+        for(int led = 1; led <= 2; led++) {
+            unsigned int bit = LED_BIT(led);
+            if(have_state && !((ev.state ^ last_state) & bit))
+                continue;
+            if(led == 2 && led2_blinking)
+                continue;
+            if(led_watch_mosq &&
+               publish_led_status(led_watch_mosq, led, (ev.state & bit) ? "1" : "0") == 0 &&
+               led == 2)
+                led2_reported = !!(ev.state & bit);
+        }
+        last_state = ev.state;
+        have_state = 1;
+        snprintf(buffer, sizeof(buffer), "LED: State 1:%d 2:%d (generation %u)",
+                 !!(ev.state & LED1), !!(ev.state & LED2), ev.generation);
+        log_data(buffer);
+    }
+    close(fd);
+    return NULL;
+}
+
+/* --------------------- RULE ENGINE --------------------- */
+/* Rule mặc định giống ngưỡng cũ của backend: nhiệt độ > 27 thì LED2 nháy */
+static void rules_load_default(void) {
+    pthread_mutex_lock(&rules_mutex);
+    memset(rules, 0, sizeof(rules));
+    snprintf(rules[0].id, RULE_ID_LEN, "temp_high");
+    rules[0].sensor = SAMPLE_TEMP;
+    rules[0].op = '>';
+    rules[0].on_level = 27.0;
+    rules[0].off_level = 27.0;
+    rules[0].led = 2;
+    rules[0].action = RULE_ACTION_BLINK;
+    rule_count = 1;
+    pthread_mutex_unlock(&rules_mutex);
+}
+
+static long timespec_diff_us(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * Điều khiển /dev/led trực tiếp khi rule đổi trạng thái, đo độ trễ từ lúc lấy mẫu.
+ * Rule chỉ tác động ở cạnh (vượt ngưỡng on/off), lệnh MQTT tác động ngay:
+ * bên ghi sau cùng thắng. Lệnh tay giữ nguyên tới lần vượt ngưỡng kế tiếp,
+ * trạng thái do rule đặt giữ nguyên tới lệnh MQTT kế tiếp.
+ */
+static void rule_actuate(const struct rule *r, int on, float value, const struct sample *s) {
+    char buffer[BUFFER_SIZE];
+    struct timespec done;
+    int ret;
+
+    if(r->led == 1)
+        led1_on = on;
+    else if(r->action == RULE_ACTION_BLINK)
+        led2_blinking = on;
+    else
+        led2_on = on;
+    ret = set_led_state(r->led, on);
+    clock_gettime(CLOCK_MONOTONIC, &done);
+
+    snprintf(buffer, sizeof(buffer), "RULE %s: LED%d %s (value %.1f), latency %ld us%s",
+             r->id, r->led, on ? "ON" : "OFF", value,
+             timespec_diff_us(&s->taken, &done), ret < 0 ? ", write failed" : "");
+    printf("%s\n", buffer);
+    fflush(stdout);
+    log_data(buffer);
+}
+
+/* Một rule vừa đổi trạng thái, chép ra để điều khiển LED ngoài rules_mutex */
+struct rule_edge {
+    struct rule rule;
+    int on;
+    float value;
+};
+
+/*
+ * Chỉ quyết định cạnh khi giữ rules_mutex; việc ghi /dev/led và log (các điểm
+ * hủy thread) làm sau khi nhả khóa để thread bị hủy giữa chừng không giữ khóa.
+ */
+void rules_evaluate(const struct sample *s) {
+    struct rule_edge edges[MAX_RULES];
+    int n_edges = 0;
+
+    pthread_mutex_lock(&rules_mutex);
+    for(int i = 0; i < rule_count; i++) {
+        struct rule *r = &rules[i];
+        float value;
+        int next;
+
+        if(!(s->valid & r->sensor))
+            continue;
+        if(r->sensor == SAMPLE_TEMP)
+            value = s->temperature;
+        else if(r->sensor == SAMPLE_HUMID)
+            value = s->humidity;
+        else
+            value = s->lux;
+
+        if(!r->active)
+            next = (r->op == '>') ? value > r->on_level : value < r->on_level;
+        else
+            next = (r->op == '>') ? value > r->off_level : value < r->off_level;
+        if(next == r->active)
+            continue;
+        r->active = next;
+        edges[n_edges].rule = *r;
+        edges[n_edges].on = next;
+        edges[n_edges].value = value;
+        n_edges++;
+    }
+    pthread_mutex_unlock(&rules_mutex);
+
+    for(int i = 0; i < n_edges; i++)
+        rule_actuate(&edges[i].rule, edges[i].on, edges[i].value, s);
+}
+
+/* Payload: {"rules":[{"id":"temp_high","sensor":"temperature","op":">","on":27,"off":26,"led":2,"action":"blink"}]} */
+static int rules_update_from_json(const cJSON *json) {
+    char buffer[BUFFER_SIZE];
+    struct rule parsed[MAX_RULES];
+    int count = 0;
+    int release[MAX_RULES];   /* LED của rule cũ cần tắt, ghi sau khi nhả khóa */
+    int n_release = 0;
+    const cJSON *item;
+    const cJSON *list = cJSON_GetObjectItem(json, "rules");
+
+    if(!list || !cJSON_IsArray(list)) {
+        log_data("RULE: Missing \"rules\" array");
+        return -1;
+    }
+    memset(parsed, 0, sizeof(parsed));
+    cJSON_ArrayForEach(item, list) {
+        struct rule *r = &parsed[count];
+        const cJSON *id = cJSON_GetObjectItem(item, "id");
+        const cJSON *sensor = cJSON_GetObjectItem(item, "sensor");
+        const cJSON *op = cJSON_GetObjectItem(item, "op");
+        const cJSON *on = cJSON_GetObjectItem(item, "on");
+        const cJSON *off = cJSON_GetObjectItem(item, "off");
+        const cJSON *led = cJSON_GetObjectItem(item, "led");
+        const cJSON *action = cJSON_GetObjectItem(item, "action");
+
+        if(count >= MAX_RULES) {
+            log_data("RULE: Too many rules, extra entries ignored");
+            break;
+        }
+        if(!cJSON_IsString(sensor) || !cJSON_IsNumber(on) || !cJSON_IsNumber(led) ||
+           (led->valueint != 1 && led->valueint != 2)) {
+            log_data("RULE: Invalid rule entry skipped");
+            continue;
+        }
+        if(strcmp(sensor->valuestring, "temperature") == 0)
+            r->sensor = SAMPLE_TEMP;
+        else if(strcmp(sensor->valuestring, "humidity") == 0)
+            r->sensor = SAMPLE_HUMID;
+        else if(strcmp(sensor->valuestring, "lux") == 0)
+            r->sensor = SAMPLE_LUX;
+        else {
+            log_data("RULE: Unknown sensor, rule skipped");
+            continue;
+        }
+        snprintf(r->id, RULE_ID_LEN, "%s", cJSON_IsString(id) ? id->valuestring : "rule");
+        r->op = (cJSON_IsString(op) && op->valuestring[0] == '<') ? '<' : '>';
+        r->on_level = (float)on->valuedouble;
+        r->off_level = cJSON_IsNumber(off) ? (float)off->valuedouble : r->on_level;
+        r->led = led->valueint;
+        r->action = (cJSON_IsString(action) && strcmp(action->valuestring, "blink") == 0)
+                    ? RULE_ACTION_BLINK : RULE_ACTION_ON;
+        count++;
+    }
+
+    pthread_mutex_lock(&rules_mutex);
+    /* Nhả các LED do rule cũ đang giữ trước khi thay bộ rule */
+    for(int i = 0; i < rule_count; i++) {
+        if(!rules[i].active)
+            continue;
+        if(rules[i].led == 1)
+            led1_on = 0;
+        else if(rules[i].action == RULE_ACTION_BLINK)
+            led2_blinking = 0;
+        else
+            led2_on = 0;
+        release[n_release++] = rules[i].led;
+    }
+    memcpy(rules, parsed, sizeof(rules));
+    rule_count = count;
+    pthread_mutex_unlock(&rules_mutex);
+    for(int i = 0; i < n_release; i++)
+        set_led_state(release[i], 0);
+
+    snprintf(buffer, sizeof(buffer), "RULE: Loaded %d rule(s)", count);
+    printf("%s\n", buffer);
+    log_data(buffer);
+    return 0;
+}
+
 /* --------------------- MQTT CALLBACK & DATA PUBLISHING --------------------- */
 void mosquitto_log_callback(struct mosquitto *mosq, void *userdata, int level, const char *str) {
     char buffer[BUFFER_SIZE];
@@ -454,16 +774,21 @@ void mosquitto_message_callback(struct mosquitto *mosq, void *userdata, const st
         log_data(buffer);
         return;
     }
+    if(strcmp(message->topic, MQTT_RULES_TOPIC) == 0) {
+        rules_update_from_json(json);
+        cJSON_Delete(json);
+        return;
+    }
     /* Xử lý LED1 */
     cJSON *led1_obj = cJSON_GetObjectItem(json, "led1");
     if(led1_obj && cJSON_IsString(led1_obj)) {
         if(strcmp(led1_obj->valuestring, "ON") == 0) {
             set_led_state(1, 1);
-            publish_led_status(mosq, 1, "1");
+            led1_on = 1;
         }
         else if(strcmp(led1_obj->valuestring, "OFF") == 0) {
             set_led_state(1, 0);
-            publish_led_status(mosq, 1, "0");
+            led1_on = 0;
         }
     }
     /* Xử lý LED2: nếu nhận "ON" thì bật nháy liên tục cho đến khi nhận "OFF" */
@@ -474,8 +799,8 @@ void mosquitto_message_callback(struct mosquitto *mosq, void *userdata, const st
         }
         else if(strcmp(led2_obj->valuestring, "OFF") == 0) {
             led2_blinking = 0;
+            led2_on = 0;
             set_led_state(2, 0);
-            publish_led_status(mosq, 2, "0");
         }
     }
     cJSON_Delete(json);
@@ -535,6 +860,12 @@ int mqtt_init_connect(struct mosquitto **mosq) {
         snprintf(buffer, sizeof(buffer), "MQTT: Failed to subscribe to %s: %s", MQTT_LED_TOPIC, mosquitto_strerror(ret));
         log_data(buffer);
     }
+    ret = mosquitto_subscribe(*mosq, NULL, MQTT_RULES_TOPIC, MQTT_QOS);
+    if(ret != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "MQTT: Failed to subscribe to %s: %s\n", MQTT_RULES_TOPIC, mosquitto_strerror(ret));
+        snprintf(buffer, sizeof(buffer), "MQTT: Failed to subscribe to %s: %s", MQTT_RULES_TOPIC, mosquitto_strerror(ret));
+        log_data(buffer);
+    }
     ret = mosquitto_loop_start(*mosq);
     if(ret != MOSQ_ERR_SUCCESS) {
         fprintf(stderr, "MQTT: Failed to start loop: %s\n", mosquitto_strerror(ret));
@@ -582,9 +913,13 @@ int main(int argc, char *argv[]) {
     time_t last_status_log = 0;
     float temp, humid;
     unsigned int lux = 0;
-    char led_status[BUFFER_SIZE];  /* trạng thái LED từ /dev/led */
+    struct sensor_stamp dht11_stamp, bh1750_stamp = { 0, 0 };
+    struct sensorhub_snapshot snap;
+    int bh1750_ok, led1_actual;
+    long long read_us = 0;
     int watchdog_fd_local = -1;
     struct mosquitto *mosq_local = NULL;
+    int led_watch_started = 0;
     
     /* Kiểm tra tham số dòng lệnh, ví dụ: --watchdog */
     for(int i = 1; i < argc; i++) {
@@ -595,6 +930,11 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    /* Tên thiết bị lấy theo hostname */
+    if(gethostname(device_id, sizeof(device_id)) != 0 || device_id[0] == '\0')
+        snprintf(device_id, sizeof(device_id), "%s", DEVICE_ID_DEFAULT);
+    device_id[sizeof(device_id) - 1] = '\0';
+    
     /* Cài đặt xử lý tín hiệu SIGINT, SIGTERM */
     struct sigaction sa;
     sa.sa_sigaction = signal_handler;
@@ -603,19 +943,24 @@ int main(int argc, char *argv[]) {
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
     
-    /* Khởi tạo thread giám sát */
-    if(pthread_create(&monitor_thread, NULL, monitor_thread_func, NULL) != 0) {
-        fprintf(stderr, "Failed to create monitor thread: %s\n", strerror(errno));
-        log_data("Failed to create monitor thread");
-        return -1;
-    }
+    /* Rule mặc định, sẽ bị thay khi nhận cấu hình trên MQTT_RULES_TOPIC */
+    rules_load_default();
     
-    /* Khởi tạo thread DHT11 */
+    /* Khởi tạo thread DHT11 trước thread giám sát, monitor tính hạn từ lúc này */
+    last_loop_time = last_dht11_time = time(NULL);
     if(pthread_create(&dht11_thread, NULL, dht11_thread_func, NULL) != 0) {
         fprintf(stderr, "Failed to create DHT11 thread: %s\n", strerror(errno));
         log_data("Failed to create DHT11 thread");
         return -1;
     }
+    dht11_thread_started = 1;
+    
+    /* Khởi tạo thread giám sát */
+    if(pthread_create(&monitor_thread, NULL, monitor_thread_func, NULL) != 0) {
+        fprintf(stderr, "Failed to create monitor thread: %s\n", strerror(errno));
+        log_data("Failed to create monitor thread");
+        return -1;
+    }
     
     /* Khởi tạo watchdog nếu kích hoạt */
     if(init_watchdog(&watchdog_fd_local) != 0) {
@@ -627,6 +972,19 @@ int main(int argc, char *argv[]) {
     /* Khởi tạo và kết nối MQTT */
     if(mqtt_init_connect(&mosq_local) == 0)
         mqtt_connected = 1;
+    led_watch_mosq = mosq_local;
+    
+    /* Thread publish trạng thái LED khi có thay đổi */
+    if(pthread_create(&led_watch_thread, NULL, led_watch_thread_func, NULL) == 0) {
+        led_watch_started = 1;
+    } else {
+        fprintf(stderr, "Failed to create LED watch thread: %s\n", strerror(errno));
+        log_data("Failed to create LED watch thread");
+    }
+    
+    sensorhub_fd = open(SENSORHUB_DEVICE_PATH, O_RDONLY);
+    if(sensorhub_fd < 0)
+        log_data("SENSORHUB: Not available, reading sensors separately");
     
     printf("Starting sensor system...\n");
     log_data("Starting sensor system");
@@ -646,10 +1004,35 @@ int main(int argc, char *argv[]) {
         pthread_mutex_lock(&dht11_mutex);
         temp = last_temp;
         humid = last_humid;
+        dht11_stamp = last_dht11_stamp;
         pthread_mutex_unlock(&dht11_mutex);
         
-        /* Đọc dữ liệu từ BH1750 */
-        if(read_bh1750(&lux) == 0) {
+        led1_actual = led1_on;
+        
+        /* Một snapshot từ /dev/sensorhub, nếu không có thì đọc BH1750 riêng */
+        if(read_sensorhub(&snap) == 0) {
+            if(snap.dht11.seq) {
+                temp = snap.dht11.temp_decicelsius / 10.0f;
+                humid = snap.dht11.hum_decipercent / 10.0f;
+                dht11_stamp.acq_us = (long long)(snap.dht11.timestamp_ns / 1000);
+                dht11_stamp.seq = snap.dht11.seq;
+            }
+            bh1750_ok = snap.bh1750.seq != 0 && snap.bh1750_error == 0;
+            if(bh1750_ok) {
+                lux = snap.bh1750.millilux / 1000;
+                bh1750_stamp.acq_us = (long long)(snap.bh1750.timestamp_ns / 1000);
+                bh1750_stamp.seq = snap.bh1750.seq;
+            }
+            led1_actual = (snap.led_state & LED1) != 0;
+        } else {
+            bh1750_ok = read_bh1750(&lux, &bh1750_stamp) == 0;
+        }
+        
+        if(bh1750_ok) {
+            read_us = now_us();
+            struct sample smp = { .lux = (float)lux, .valid = SAMPLE_LUX };
+            clock_gettime(CLOCK_MONOTONIC, &smp.taken);
+            rules_evaluate(&smp);
             snprintf(log_buffer, sizeof(log_buffer), "BH1750: Light: %u lux", lux);
             log_data(log_buffer);
             printf("BH1750: Light: %u lux\n", lux);
@@ -661,22 +1044,27 @@ int main(int argc, char *argv[]) {
             fflush(stdout);
         }
         
-        /* Đọc trạng thái LED từ /dev/led (dùng cho log) */
-        if(read_led_status(led_status, sizeof(led_status)) == 0) {
-            printf("LED status (from /dev/led): %s\n", led_status);
-            fflush(stdout);
-            log_data(led_status);
-        } else {
-            log_data("Failed to read LED status");
-        }
-        
         /* Gửi dữ liệu cảm biến lên MQTT topic sensors (chỉ gồm temperature, humidity, lux) */
         if(mqtt_connected) {
             cJSON *jobj = cJSON_CreateObject();
             if(jobj) {
+                cJSON_AddStringToObject(jobj, "device", device_id);
                 cJSON_AddNumberToObject(jobj, "temperature", temp);
                 cJSON_AddNumberToObject(jobj, "humidity", humid);
                 cJSON_AddNumberToObject(jobj, "lux", (double)lux);
+                /* Trạng thái LED thực tế trên thiết bị (LED2 do rule engine quyết định) */
+                cJSON_AddStringToObject(jobj, "led1", led1_actual ? "ON" : "OFF");
+                cJSON_AddStringToObject(jobj, "led2", (led2_blinking || led2_on) ? "ON" : "OFF");
+                /* Mốc thời gian từng chặng: driver lấy mẫu -> app đọc -> publish */
+                cJSON *trace = cJSON_AddObjectToObject(jobj, "trace");
+                if(trace) {
+                    cJSON_AddNumberToObject(trace, "dht11_seq", dht11_stamp.seq);
+                    cJSON_AddNumberToObject(trace, "dht11_acq", (double)dht11_stamp.acq_us);
+                    cJSON_AddNumberToObject(trace, "bh1750_seq", bh1750_stamp.seq);
+                    cJSON_AddNumberToObject(trace, "bh1750_acq", (double)bh1750_stamp.acq_us);
+                    cJSON_AddNumberToObject(trace, "read", (double)read_us);
+                    cJSON_AddNumberToObject(trace, "pub", (double)now_us());
+                }
                 char *payload = cJSON_PrintUnformatted(jobj);
                 if(payload) {
                     publish_mqtt(mosq_local, MQTT_SENSOR_TOPIC, payload);
@@ -706,11 +1094,17 @@ int main(int argc, char *argv[]) {
     
     log_data("Cleaning up before exit");
     running = 0;
-    pthread_cancel(dht11_thread);
-    pthread_cancel(monitor_thread);
-    pthread_join(dht11_thread, NULL);
+    /* Các thread tự thoát khi thấy running = 0; monitor trước vì nó có thể
+     * đang khởi động lại thread DHT11 */
     pthread_join(monitor_thread, NULL);
+    if(dht11_thread_started)
+        pthread_join(dht11_thread, NULL);
+    if(led_watch_started)
+        pthread_join(led_watch_thread, NULL);
+    led_watch_mosq = NULL;
     pthread_mutex_destroy(&dht11_mutex);
+    if(sensorhub_fd >= 0)
+        close(sensorhub_fd);
     disable_watchdog(watchdog_fd_local);
     if(mosq_local) {
         mosquitto_loop_stop(mosq_local, true);
@@ -0,0 +1,65 @@
+/*
+ * Tracepoints of driver_bh1750.c (trace system "bh1750"): one event per
+ * bus transfer (both transports) and, on the bit-bang transport, one per
+ * byte with its ACK. Byte timing is only taken while the event is enabled.
+ *
+ * The header is found again through TRACE_INCLUDE_PATH, which is why
+ * Kbuild sets CFLAGS_driver_bh1750.o := -I$(src).
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM bh1750
+
+#if !defined(_BH1750_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BH1750_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(bh1750_byte,
+    TP_PROTO(bool read, u8 value, bool ack, u32 duration_ns),
+    TP_ARGS(read, value, ack, duration_ns),
+    TP_STRUCT__entry(
+        __field(bool, read)
+        __field(u8, value)
+        __field(bool, ack)
+        __field(u32, duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->read = read;
+        __entry->value = value;
+        __entry->ack = ack;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("%s 0x%02x %s duration=%uns", __entry->read ? "read" : "write",
+              __entry->value, __entry->ack ? "ACK" : "NACK", __entry->duration_ns)
+);
+
+/* value: the command byte for a write, the raw count for a read */
+TRACE_EVENT(bh1750_xfer,
+    TP_PROTO(bool hw, bool read, u16 value, int ret, u64 duration_ns),
+    TP_ARGS(hw, read, value, ret, duration_ns),
+    TP_STRUCT__entry(
+        __field(bool, hw)
+        __field(bool, read)
+        __field(u16, value)
+        __field(int, ret)
+        __field(u64, duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->hw = hw;
+        __entry->read = read;
+        __entry->value = value;
+        __entry->ret = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("bus=%s %s 0x%04x ret=%d duration=%lluns",
+              __entry->hw ? "i2c" : "bitbang", __entry->read ? "read" : "cmd",
+              __entry->value, __entry->ret, __entry->duration_ns)
+);
+
+#endif /* _BH1750_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE bh1750_trace
+#include <trace/define_trace.h>
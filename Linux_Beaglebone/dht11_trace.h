@@ -0,0 +1,140 @@
+/*
+ * Tracepoints of driver_dht11.c (trace system "dht11"):
+ *   echo 1 > /sys/kernel/tracing/events/dht11/enable
+ *   cat /sys/kernel/tracing/trace_pipe
+ * or perf record -e 'dht11:*'. Durations are measured with ktime; margins
+ * are how far the closest bit of a byte was from the decoder's threshold
+ * (30 us sample point when polling, 100 us edge gap with use_irq).
+ *
+ * The header is found again through TRACE_INCLUDE_PATH, which is why
+ * Kbuild sets CFLAGS_driver_dht11.o := -I$(src).
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dht11
+
+#if !defined(_DHT11_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DHT11_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#ifndef DHT11_TRACE_STAGES
+#define DHT11_TRACE_STAGES
+/* Where a read failed, reported by dht11_error */
+enum dht11_stage {
+    DHT11_STAGE_IDLE,           /* Line low before the start pulse */
+    DHT11_STAGE_RESPONSE_LOW,   /* Sensor never pulled the line low */
+    DHT11_STAGE_RESPONSE_HIGH,  /* Sensor never released it again */
+    DHT11_STAGE_BIT_HIGH,       /* Polling: bit never went high */
+    DHT11_STAGE_BIT_LOW,        /* Polling: bit never went low */
+    DHT11_STAGE_EDGES,          /* IRQ: not all falling edges captured */
+    DHT11_STAGE_PULSE,          /* IRQ: edge gap outside the valid range */
+};
+#endif
+
+TRACE_DEFINE_ENUM(DHT11_STAGE_IDLE);
+TRACE_DEFINE_ENUM(DHT11_STAGE_RESPONSE_LOW);
+TRACE_DEFINE_ENUM(DHT11_STAGE_RESPONSE_HIGH);
+TRACE_DEFINE_ENUM(DHT11_STAGE_BIT_HIGH);
+TRACE_DEFINE_ENUM(DHT11_STAGE_BIT_LOW);
+TRACE_DEFINE_ENUM(DHT11_STAGE_EDGES);
+TRACE_DEFINE_ENUM(DHT11_STAGE_PULSE);
+
+TRACE_EVENT(dht11_start,
+    TP_PROTO(bool irq_mode, u32 pulse_us),
+    TP_ARGS(irq_mode, pulse_us),
+    TP_STRUCT__entry(
+        __field(bool, irq_mode)
+        __field(u32, pulse_us)
+    ),
+    TP_fast_assign(
+        __entry->irq_mode = irq_mode;
+        __entry->pulse_us = pulse_us;
+    ),
+    TP_printk("mode=%s pulse=%uus",
+              __entry->irq_mode ? "irq" : "poll", __entry->pulse_us)
+);
+
+/* wait: release of the line to the sensor's low; response: its 80+80 us reply */
+TRACE_EVENT(dht11_response,
+    TP_PROTO(u32 wait_us, u32 response_us),
+    TP_ARGS(wait_us, response_us),
+    TP_STRUCT__entry(
+        __field(u32, wait_us)
+        __field(u32, response_us)
+    ),
+    TP_fast_assign(
+        __entry->wait_us = wait_us;
+        __entry->response_us = response_us;
+    ),
+    TP_printk("wait=%uus response=%uus", __entry->wait_us, __entry->response_us)
+);
+
+TRACE_EVENT(dht11_byte,
+    TP_PROTO(unsigned int index, u8 value, u32 duration_us, u32 margin_us),
+    TP_ARGS(index, value, duration_us, margin_us),
+    TP_STRUCT__entry(
+        __field(unsigned int, index)
+        __field(u8, value)
+        __field(u32, duration_us)
+        __field(u32, margin_us)
+    ),
+    TP_fast_assign(
+        __entry->index = index;
+        __entry->value = value;
+        __entry->duration_us = duration_us;
+        __entry->margin_us = margin_us;
+    ),
+    TP_printk("byte=%u value=0x%02x duration=%uus margin=%uus",
+              __entry->index, __entry->value, __entry->duration_us, __entry->margin_us)
+);
+
+TRACE_EVENT(dht11_checksum,
+    TP_PROTO(const u8 *raw, bool ok, u32 total_us),
+    TP_ARGS(raw, ok, total_us),
+    TP_STRUCT__entry(
+        __array(u8, raw, 5)
+        __field(bool, ok)
+        __field(u32, total_us)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->raw, raw, 5);
+        __entry->ok = ok;
+        __entry->total_us = total_us;
+    ),
+    TP_printk("raw=%s %s total=%uus", __print_hex(__entry->raw, 5),
+              __entry->ok ? "ok" : "MISMATCH", __entry->total_us)
+);
+
+/* pos: bit index (0-39), or edges captured for DHT11_STAGE_EDGES, -1 if none */
+TRACE_EVENT(dht11_error,
+    TP_PROTO(int stage, int pos, int ret),
+    TP_ARGS(stage, pos, ret),
+    TP_STRUCT__entry(
+        __field(int, stage)
+        __field(int, pos)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->stage = stage;
+        __entry->pos = pos;
+        __entry->ret = ret;
+    ),
+    TP_printk("stage=%s pos=%d ret=%d",
+              __print_symbolic(__entry->stage,
+                               { DHT11_STAGE_IDLE, "idle" },
+                               { DHT11_STAGE_RESPONSE_LOW, "response_low" },
+                               { DHT11_STAGE_RESPONSE_HIGH, "response_high" },
+                               { DHT11_STAGE_BIT_HIGH, "bit_high" },
+                               { DHT11_STAGE_BIT_LOW, "bit_low" },
+                               { DHT11_STAGE_EDGES, "edges" },
+                               { DHT11_STAGE_PULSE, "pulse" }),
+              __entry->pos, __entry->ret)
+);
+
+#endif /* _DHT11_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dht11_trace
+#include <trace/define_trace.h>
@@ -3,17 +3,52 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/uaccess.h>
-#include <linux/io.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
 #include <linux/jiffies.h>
-#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
 #include <linux/errno.h>
 #include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/i2c.h>
+#include <linux/swab.h>
+#include <linux/kfifo.h>
+#include <linux/mm.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+
+#include "include/bh1750.h"
+#include "gpio1_core.h"
+#include "sensorhub_sources.h"
+
+#define CREATE_TRACE_POINTS
+#include "bh1750_trace.h"
+
+/*
+ * The sensor can be reached two ways:
+ *  - bit-banged I2C on GPIO1_16 (SDA) / GPIO1_17 (SCL), the default wiring,
+ *    driven open drain at bus_khz (the breakout's pull-ups must be fitted);
+ *  - an i2c_client on a hardware adapter (use_hw_i2c=1), e.g. the AM335x
+ *    I2C2 controller on P9.19/P9.20, where transfers are interrupt driven.
+ *
+ * The hardware path also runs on any Linux box against i2c-stub:
+ *   modprobe i2c-stub chip_addr=0x23
+ *   insmod bh1750_1.ko use_hw_i2c=1 i2c_adapter=<N of "SMBus stub driver">
+ *   i2cset -y <N> 0x23 0x10 0x3412 w   # raw 0x1234 for CMD_CONT_HIGH
+ *   cat /dev/bh1750                     # 3883 lux
+ * i2c-stub has no plain I2C reads, so SMBus-only adapters fetch the result
+ * with a read-word on the measurement command (see hw_get_raw_value()).
+ */
 
 /* Device config */
 #define DEVICE_NAME "bh1750"
 #define CLASS_NAME  "bh1750_class"
+#define I2C_CLIENT_NAME "bh1750_bbb"
 
 /* BH1750 I2C addr & commands */
 #define BH1750_ADDR 0x23
@@ -24,41 +59,94 @@
 #define CMD_CONT_HIGH2   0x11
 #define CMD_CONT_LOW     0x13
 #define CMD_ONETIME_HIGH 0x20
+#define CMD_ONETIME_HIGH2 0x21
 #define CMD_ONETIME_LOW  0x23
+#define CMD_MTREG_HIGH   0x40   /* | MTreg[7:5] */
+#define CMD_MTREG_LOW    0x60   /* | MTreg[4:0] */
 
-/* GPIO base & offsets for I2C bit-bang */
-#define GPIO1_BASE_ADDR 0x4804C000
-#define GPIO_MEM_SIZE   0x1000
-#define GPIO_OE_OFFSET        0x134
-#define GPIO_SET_OFFSET       0x194
-#define GPIO_CLR_OFFSET       0x190
-#define GPIO_IN_OFFSET        0x138
+/* Auto-ranging window on the raw count */
+#define AUTO_RANGE_HIGH  50000  /* Close to saturation: halve MTreg */
+#define AUTO_RANGE_LOW   5000   /* Dark: double MTreg, then switch to H2 */
 
+/* GPIO1 pins for I2C bit-bang */
 #define SCL_PIN   17
 #define SDA_PIN   16
 #define SCL_MASK  (1 << SCL_PIN)
 #define SDA_MASK  (1 << SDA_PIN)
 
 /* Timing */
-#define I2C_DELAY_US 5
+#define DEFAULT_BUS_KHZ 100
+#define DEFAULT_STRETCH_TIMEOUT_US 1000
 #define DEFAULT_REFRESH_INTERVAL 1000 /* ms */
 
+/* Sample ring, must be a power of two */
+#define FIFO_RECORDS 256
+#define FIFO_CHUNK   16     /* Records copied per spinlock hold in read() */
+
+/* debugfs transaction histogram: bucket n counts [2^n, 2^(n+1)) us */
+#define STATS_HIST_BUCKETS 16
+
 /* Globals */
 static int major;
 static struct class *bh_class = NULL;
 static struct device *bh_device = NULL;
 static struct cdev bh_cdev;
-static void __iomem *gpio_base;
+static bool bb_claimed;                    /* SCL/SDA held through gpio1_core */
+static struct i2c_client *bh_client;       /* Bound hardware I2C client, if any */
+static struct i2c_client *bh_auto_client;  /* Client we instantiated ourselves */
+
+/* Transport used by bh1750_send_command()/bh1750_get_raw_value() */
+struct bh1750_bus {
+    const char *name;
+    int (*send_command)(unsigned char cmd);
+    int (*get_raw_value)(unsigned short *value);
+};
+static const struct bh1750_bus *bus;
 
 /* Sensor data */
 struct bh_sensor {
     unsigned int lux;
     unsigned long last_update;
-    struct mutex lock;
+    u64 timestamp_ns;   /* CLOCK_REALTIME at acquisition, for end-to-end tracing */
+    u32 seq;            /* Incremented on every successful acquisition */
+    u32 attempts;       /* Incremented on every acquisition, successful or not */
+    u32 started;        /* Incremented when an acquisition starts (sensorhub tickets) */
+    int last_error;
+    u64 fifo_overflows;
+    spinlock_t data_lock;     /* Protects the sample fields above and the ring */
+    wait_queue_head_t wq;     /* Woken after every acquisition attempt */
+    struct mutex lock;        /* Serializes bus transactions */
     bool initialized;
     bool cont_mode;
 };
 static struct bh_sensor sensor;
+static DECLARE_KFIFO(sample_fifo, struct bh1750_record, FIFO_RECORDS);
+static DEFINE_MUTEX(fifo_read_lock);       /* One binary reader drains at a time */
+static struct bh1750_shared *shared_page;  /* mmap()ed latest sample */
+
+/*
+ * Counters shown in debugfs (bh1750/stats), cleared by writing to it. A
+ * read is a cache hit when it returns without waiting for an acquisition.
+ */
+struct bh_stats {
+    atomic64_t reads;
+    atomic64_t cache_hits;
+    atomic64_t nacks;            /* Failed bus transfers (NACK, stuck clock) */
+    atomic64_t reinits;          /* bh1750_sensor_init() runs */
+    atomic64_t timer_refreshes;  /* Worker acquisitions from auto_refresh */
+    atomic64_t demand_refreshes; /* Worker acquisitions requested by read() */
+    atomic64_t xfers;
+    atomic64_t xfer_ns;          /* Sum of transfer durations */
+    atomic64_t xfer_hist[STATS_HIST_BUCKETS];
+};
+static struct bh_stats stats;
+static struct dentry *debug_dir;
+
+/* Per-open state: last sample generation this file has returned */
+struct bh_file {
+    u32 seen_seq;
+    u32 format;         /* BH1750_FORMAT_* */
+};
 
 /* Module params */
 static unsigned int refresh_interval = DEFAULT_REFRESH_INTERVAL;
@@ -67,139 +155,319 @@ module_param(refresh_interval, uint, 0644);
 MODULE_PARM_DESC(refresh_interval, "Refresh interval in ms");
 module_param(auto_refresh, bool, 0644);
 MODULE_PARM_DESC(auto_refresh, "Enable auto refresh");
+static bool use_hw_i2c;
+static int i2c_adapter = -1;
+module_param(use_hw_i2c, bool, 0444);
+MODULE_PARM_DESC(use_hw_i2c, "Use a hardware I2C adapter instead of bit-banging GPIO1_16/17");
+module_param(i2c_adapter, int, 0444);
+MODULE_PARM_DESC(i2c_adapter, "Instantiate the sensor at 0x23 on this I2C adapter (use_hw_i2c only)");
+
+static unsigned int bus_khz = DEFAULT_BUS_KHZ;
+static unsigned int stretch_timeout_us = DEFAULT_STRETCH_TIMEOUT_US;
+module_param(bus_khz, uint, 0644);
+MODULE_PARM_DESC(bus_khz, "Bit-bang I2C clock in kHz (100 standard, 400 fast)");
+module_param(stretch_timeout_us, uint, 0644);
+MODULE_PARM_DESC(stretch_timeout_us, "Longest SCL clock stretch accepted from the sensor");
 
+/* Measurement configuration, protected by sensor.lock */
 static unsigned char meas_mode = CMD_CONT_HIGH;
+static unsigned char mtreg = BH1750_MTREG_DEFAULT;
+static bool auto_range;
+
+/*
+ * I2C bit-bang engine. Both lines are open drain: DATAOUT stays 0 and a
+ * line is pulled low by making the pin an output, released (pulled high by
+ * the module's pull-ups) by making it an input. gpio1_core only writes OE
+ * when a line actually changes state, and releasing SCL waits for it to
+ * read high so a slave may stretch the clock.
+ */
+static unsigned int bb_t_low_ns;          /* SCL low phase, register cost removed */
+static unsigned int bb_t_high_ns;         /* SCL high phase, register cost removed */
+static unsigned int bb_io_ns;             /* Measured cost of one GPIO register access */
 
-/* I2C bit-bang helpers */
-static inline void gpio_set_clock(int val)
+static inline void bb_line(u32 mask, int high)
 {
-    if (val)
-        iowrite32(SCL_MASK, gpio_base + GPIO_SET_OFFSET);
+    if (high)
+        gpio1_input(mask);
     else
-        iowrite32(SCL_MASK, gpio_base + GPIO_CLR_OFFSET);
-    udelay(I2C_DELAY_US);
+        gpio1_output(mask);
 }
 
-static inline void gpio_set_data(int val)
+static inline int bb_read(u32 mask)
 {
-    if (val)
-        iowrite32(SDA_MASK, gpio_base + GPIO_SET_OFFSET);
-    else
-        iowrite32(SDA_MASK, gpio_base + GPIO_CLR_OFFSET);
-    udelay(I2C_DELAY_US);
+    return (gpio1_read_in() & mask) ? 1 : 0;
 }
 
-static inline void configure_sda_in(void)
+static inline void bb_delay(unsigned int ns)
 {
-    u32 reg = ioread32(gpio_base + GPIO_OE_OFFSET);
-    iowrite32(reg | SDA_MASK, gpio_base + GPIO_OE_OFFSET);
-    udelay(I2C_DELAY_US);
+    if (ns)
+        ndelay(ns);
 }
 
-static inline void configure_sda_out(void)
+/* Release SCL and wait while the slave holds it low */
+static int bb_scl_high(void)
 {
-    u32 reg = ioread32(gpio_base + GPIO_OE_OFFSET);
-    iowrite32(reg & ~SDA_MASK, gpio_base + GPIO_OE_OFFSET);
-    udelay(I2C_DELAY_US);
+    ktime_t deadline;
+
+    bb_line(SCL_MASK, 1);
+    if (bb_read(SCL_MASK))
+        return 0;
+    deadline = ktime_add_us(ktime_get(), stretch_timeout_us);
+    while (!bb_read(SCL_MASK)) {
+        if (ktime_after(ktime_get(), deadline))
+            return -ETIMEDOUT;
+        cpu_relax();
+    }
+    return 0;
 }
 
-static inline int gpio_read_data(void)
+/*
+ * Derive the clock phases from bus_khz: 52% low / 48% high meets the
+ * tLOW/tHIGH minimums of both standard (4.7/4.0 us) and fast mode
+ * (1.3/0.6 us). Each phase already contains a GPIO register access, so
+ * that cost is taken off the delay.
+ */
+static void bb_update_timing(void)
 {
-    u32 reg = ioread32(gpio_base + GPIO_IN_OFFSET);
-    return (reg & SDA_MASK) ? 1 : 0;
+    unsigned int khz = clamp_val(bus_khz, 10, 1000);
+    unsigned int period_ns = 1000000 / khz;
+    unsigned int io_ns = 2 * bb_io_ns;
+    unsigned int t_low = period_ns * 52 / 100;
+    unsigned int t_high = period_ns - t_low;
+
+    bb_t_low_ns = t_low > io_ns ? t_low - io_ns : 0;
+    bb_t_high_ns = t_high > io_ns ? t_high - io_ns : 0;
 }
 
-static void i2c_begin(void)
+/* Time GPIO register reads once at load; writes are posted and cheaper */
+static void bb_calibrate(void)
 {
-    configure_sda_out();
-    gpio_set_data(1);
-    gpio_set_clock(1);
-    gpio_set_data(0);
-    gpio_set_clock(0);
+    ktime_t start;
+    int i;
+
+    start = ktime_get();
+    for (i = 0; i < 256; i++)
+        (void)gpio1_read_in();
+    bb_io_ns = ktime_to_ns(ktime_sub(ktime_get(), start)) / 256;
+    bb_update_timing();
+    pr_info("BH1750: GPIO access %u ns, SCL low/high %u/%u ns at %u kHz\n",
+            bb_io_ns, bb_t_low_ns, bb_t_high_ns, bus_khz);
+}
+
+static int i2c_begin(void)
+{
+    int ret;
+
+    bb_update_timing();
+    bb_line(SDA_MASK, 1);
+    ret = bb_scl_high();
+    if (ret < 0)
+        return ret;
+    bb_delay(bb_t_high_ns);
+    bb_line(SDA_MASK, 0);       /* START: SDA falls while SCL is high */
+    bb_delay(bb_t_high_ns);
+    bb_line(SCL_MASK, 0);
+    return 0;
 }
 
 static void i2c_end(void)
 {
-    configure_sda_out();
-    gpio_set_data(0);
-    gpio_set_clock(1);
-    gpio_set_data(1);
+    bb_line(SDA_MASK, 0);
+    bb_delay(bb_t_low_ns);
+    bb_scl_high();
+    bb_delay(bb_t_high_ns);
+    bb_line(SDA_MASK, 1);       /* STOP: SDA rises while SCL is high */
+    bb_delay(bb_t_low_ns);
 }
 
+/* Clock one bit out (SDA already set) or in; returns SDA sampled while SCL is high */
+static int i2c_clock_bit(void)
+{
+    int ret, bit;
+
+    bb_delay(bb_t_low_ns);
+    ret = bb_scl_high();
+    if (ret < 0)
+        return ret;
+    bb_delay(bb_t_high_ns);
+    bit = bb_read(SDA_MASK);
+    bb_line(SCL_MASK, 0);
+    return bit;
+}
+
+/* Returns 1 on ACK, 0 on NACK, negative on a stuck clock */
 static int i2c_send_byte(unsigned char byte)
 {
-    int i, ack;
-    configure_sda_out();
+    ktime_t start = trace_bh1750_byte_enabled() ? ktime_get() : 0;
+    int i, ret;
+
     for (i = 7; i >= 0; i--) {
-        gpio_set_data((byte >> i) & 1);
-        gpio_set_clock(1);
-        gpio_set_clock(0);
+        bb_line(SDA_MASK, (byte >> i) & 1);
+        ret = i2c_clock_bit();
+        if (ret < 0)
+            return ret;
     }
-    configure_sda_in();
-    gpio_set_clock(1);
-    ack = !gpio_read_data();
-    gpio_set_clock(0);
-    return ack;
+    bb_line(SDA_MASK, 1);
+    ret = i2c_clock_bit();
+    if (ret < 0)
+        return ret;
+    if (start)
+        trace_bh1750_byte(false, byte, !ret, ktime_to_ns(ktime_sub(ktime_get(), start)));
+    return !ret;
 }
 
-static unsigned char i2c_receive_byte(int ack)
+static int i2c_receive_byte(int ack, unsigned char *byte)
 {
-    int i;
-    unsigned char byte = 0;
-    configure_sda_in();
+    ktime_t start = trace_bh1750_byte_enabled() ? ktime_get() : 0;
+    int i, ret;
+
+    *byte = 0;
+    bb_line(SDA_MASK, 1);
     for (i = 7; i >= 0; i--) {
-        gpio_set_clock(1);
-        if (gpio_read_data())
-            byte |= (1 << i);
-        gpio_set_clock(0);
+        ret = i2c_clock_bit();
+        if (ret < 0)
+            return ret;
+        if (ret)
+            *byte |= (1 << i);
     }
-    configure_sda_out();
-    gpio_set_data(!ack);
-    gpio_set_clock(1);
-    gpio_set_clock(0);
-    return byte;
+    bb_line(SDA_MASK, !ack);
+    ret = i2c_clock_bit();
+    bb_line(SDA_MASK, 1);
+    if (ret < 0)
+        return ret;
+    if (start)
+        trace_bh1750_byte(true, *byte, ack, ktime_to_ns(ktime_sub(ktime_get(), start)));
+    return 0;
 }
 
-/* BH1750 communication */
-static int bh1750_send_command(unsigned char cmd)
+/* Bit-bang transport */
+static int bitbang_send_command(unsigned char cmd)
 {
     int ret;
-    i2c_begin();
+
+    ret = i2c_begin();
+    if (ret < 0)
+        return ret;
     ret = i2c_send_byte(BH1750_ADDR << 1);
-    if (!ret) { i2c_end(); return -EIO; }
+    if (ret <= 0) { i2c_end(); return ret ?: -EIO; }
     ret = i2c_send_byte(cmd);
-    if (!ret) { i2c_end(); return -EIO; }
+    if (ret <= 0) { i2c_end(); return ret ?: -EIO; }
     i2c_end();
     return 0;
 }
 
-static int bh1750_get_raw_value(unsigned short *value)
+static int bitbang_get_raw_value(unsigned short *value)
 {
     unsigned char msb, lsb;
     int ret;
-    i2c_begin();
+
+    ret = i2c_begin();
+    if (ret < 0)
+        return ret;
     ret = i2c_send_byte((BH1750_ADDR << 1) | 1);
-    if (!ret) { i2c_end(); return -EIO; }
-    msb = i2c_receive_byte(1);
-    lsb = i2c_receive_byte(0);
+    if (ret <= 0) { i2c_end(); return ret ?: -EIO; }
+    ret = i2c_receive_byte(1, &msb);
+    if (!ret)
+        ret = i2c_receive_byte(0, &lsb);
     i2c_end();
+    if (ret < 0)
+        return ret;
     *value = (msb << 8) | lsb;
     return 0;
 }
 
-static unsigned int bh1750_get_wait_time(unsigned char mode)
+static const struct bh1750_bus bitbang_bus = {
+    .name = "bitbang",
+    .send_command = bitbang_send_command,
+    .get_raw_value = bitbang_get_raw_value,
+};
+
+/* Hardware I2C transport, callers hold sensor.lock */
+static int hw_send_command(unsigned char cmd)
+{
+    if (!bh_client)
+        return -ENODEV;
+    return i2c_smbus_write_byte(bh_client, cmd) < 0 ? -EIO : 0;
+}
+
+static int hw_get_raw_value(unsigned short *value)
 {
+    u8 buf[2];
+    int ret;
+
+    if (!bh_client)
+        return -ENODEV;
+
+    if (i2c_check_functionality(bh_client->adapter, I2C_FUNC_I2C)) {
+        ret = i2c_master_recv(bh_client, buf, sizeof(buf));
+        if (ret != sizeof(buf))
+            return -EIO;
+        *value = (buf[0] << 8) | buf[1];
+        return 0;
+    }
+
+    /* SMBus-only adapter (i2c-stub): word at the mode command, LSB first */
+    ret = i2c_smbus_read_word_data(bh_client, meas_mode);
+    if (ret < 0)
+        return -EIO;
+    *value = swab16((u16)ret);
+    return 0;
+}
+
+static const struct bh1750_bus hw_bus = {
+    .name = "i2c",
+    .send_command = hw_send_command,
+    .get_raw_value = hw_get_raw_value,
+};
+
+/* Account one bus transfer started at `start` */
+static void bh1750_stats_xfer(ktime_t start, bool read, u16 value, int ret)
+{
+    s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    u64 us = div_u64(ns, NSEC_PER_USEC);
+    unsigned int bucket = us ? min_t(unsigned int, ilog2(us), STATS_HIST_BUCKETS - 1) : 0;
+
+    atomic64_inc(&stats.xfers);
+    atomic64_add(ns, &stats.xfer_ns);
+    atomic64_inc(&stats.xfer_hist[bucket]);
+    if (ret < 0)
+        atomic64_inc(&stats.nacks);
+    trace_bh1750_xfer(bus == &hw_bus, read, value, ret, ns);
+}
+
+/* BH1750 communication */
+static int bh1750_send_command(unsigned char cmd)
+{
+    ktime_t start = ktime_get();
+    int ret = bus->send_command(cmd);
+
+    bh1750_stats_xfer(start, false, cmd, ret);
+    return ret;
+}
+
+static int bh1750_get_raw_value(unsigned short *value)
+{
+    ktime_t start = ktime_get();
+    int ret = bus->get_raw_value(value);
+
+    bh1750_stats_xfer(start, true, ret < 0 ? 0 : *value, ret);
+    return ret;
+}
+
+static unsigned int bh1750_get_wait_time(unsigned char mode, unsigned char mt)
+{
+    unsigned int base;
+
     switch (mode) {
-    case CMD_CONT_HIGH:
-    case CMD_CONT_HIGH2:
-    case CMD_ONETIME_HIGH:
-        return 180;
     case CMD_CONT_LOW:
     case CMD_ONETIME_LOW:
-        return 24;
+        base = 24;
+        break;
     default:
-        return 180;
+        base = 180;
+        break;
     }
+    return DIV_ROUND_UP(base * mt, BH1750_MTREG_DEFAULT);
 }
 
 static bool bh1750_is_continuous_mode(unsigned char mode)
@@ -207,26 +475,105 @@ static bool bh1750_is_continuous_mode(unsigned char mode)
     return (mode == CMD_CONT_HIGH || mode == CMD_CONT_HIGH2 || mode == CMD_CONT_LOW);
 }
 
+static bool bh1750_is_valid_mode(unsigned char mode)
+{
+    return bh1750_is_continuous_mode(mode) || mode == CMD_ONETIME_HIGH ||
+           mode == CMD_ONETIME_HIGH2 || mode == CMD_ONETIME_LOW;
+}
+
+/* lux = raw / 1.2 * (69 / MTreg), halved again in the H2 modes */
+static u32 bh1750_raw_to_millilux(unsigned int raw, unsigned char mode, unsigned char mt)
+{
+    u32 div = 12 * mt;
+
+    if (mode == CMD_CONT_HIGH2 || mode == CMD_ONETIME_HIGH2)
+        div *= 2;
+    return div_u64((u64)raw * 10000 * BH1750_MTREG_DEFAULT, div);
+}
+
+static int bh1750_set_mtreg(unsigned char mt)
+{
+    int ret;
+
+    ret = bh1750_send_command(CMD_MTREG_HIGH | (mt >> 5));
+    if (ret < 0)
+        return ret;
+    return bh1750_send_command(CMD_MTREG_LOW | (mt & 0x1f));
+}
+
 static int bh1750_sensor_init(void)
 {
     int ret;
+
+    atomic64_inc(&stats.reinits);
     ret = bh1750_send_command(CMD_POWER_ON);
     if (ret < 0)
         return ret;
     ret = bh1750_send_command(CMD_RESET);
+    if (ret < 0)
+        return ret;
+    ret = bh1750_set_mtreg(mtreg);
     if (ret < 0)
         return ret;
     ret = bh1750_send_command(meas_mode);
     if (ret < 0)
         return ret;
-    msleep(bh1750_get_wait_time(meas_mode));
+    msleep(bh1750_get_wait_time(meas_mode, mtreg));
     sensor.initialized = true;
     sensor.cont_mode = bh1750_is_continuous_mode(meas_mode);
     return 0;
 }
 
+/*
+ * Pick the next MTreg/mode from the last raw count, called with sensor.lock
+ * held. Bright light shortens integration (higher sample rate, no
+ * saturation); darkness lengthens it and finally switches H to H2.
+ * The new settings take effect from the next acquisition.
+ */
+static void bh1750_auto_range(unsigned short raw)
+{
+    unsigned char new_mt = mtreg;
+    unsigned char new_mode = meas_mode;
+
+    if (raw > AUTO_RANGE_HIGH) {
+        if (meas_mode == CMD_CONT_HIGH2)
+            new_mode = CMD_CONT_HIGH;
+        else if (meas_mode == CMD_ONETIME_HIGH2)
+            new_mode = CMD_ONETIME_HIGH;
+        else
+            new_mt = max_t(unsigned int, mtreg / 2, BH1750_MTREG_MIN);
+    } else if (raw < AUTO_RANGE_LOW) {
+        if (mtreg < BH1750_MTREG_MAX)
+            new_mt = min_t(unsigned int, mtreg * 2, BH1750_MTREG_MAX);
+        else if (meas_mode == CMD_CONT_HIGH)
+            new_mode = CMD_CONT_HIGH2;
+        else if (meas_mode == CMD_ONETIME_HIGH)
+            new_mode = CMD_ONETIME_HIGH2;
+    }
+
+    if (new_mt == mtreg && new_mode == meas_mode)
+        return;
+    mtreg = new_mt;
+    meas_mode = new_mode;
+    sensor.initialized = false;
+}
+
+/* Seqlock writer for the mmap page, called with data_lock held */
+static void bh1750_publish_shared(const struct bh1750_record *rec)
+{
+    WRITE_ONCE(shared_page->sequence, shared_page->sequence + 1);
+    smp_wmb();
+    shared_page->seq = rec->seq;
+    shared_page->timestamp_ns = rec->timestamp_ns;
+    shared_page->millilux = rec->millilux;
+    shared_page->raw = rec->raw;
+    smp_wmb();
+    WRITE_ONCE(shared_page->sequence, shared_page->sequence + 1);
+}
+
 static int bh1750_read_lux_value(unsigned int *lux)
 {
+    struct bh1750_record rec = { 0 };
     unsigned short raw;
     int ret;
 
@@ -243,71 +590,389 @@ static int bh1750_read_lux_value(unsigned int *lux)
             mutex_unlock(&sensor.lock);
             return ret;
         }
-        msleep(bh1750_get_wait_time(meas_mode));
+        msleep(bh1750_get_wait_time(meas_mode, mtreg));
     }
     ret = bh1750_get_raw_value(&raw);
     if (ret < 0) {
         mutex_unlock(&sensor.lock);
         return ret;
     }
-    *lux = (raw * 10) / 12;
+    rec.raw = raw;
+    rec.millilux = bh1750_raw_to_millilux(raw, meas_mode, mtreg);
+    if (auto_range)
+        bh1750_auto_range(raw);
+    mutex_unlock(&sensor.lock);
+
+    *lux = rec.millilux / 1000;
+
+    spin_lock(&sensor.data_lock);
     sensor.lux = *lux;
     sensor.last_update = jiffies;
-    mutex_unlock(&sensor.lock);
+    sensor.timestamp_ns = ktime_get_real_ns();
+    sensor.seq++;
+    rec.timestamp_ns = sensor.timestamp_ns;
+    rec.seq = sensor.seq;
+    /* Keep the newest samples: drop the oldest one when the ring is full */
+    if (kfifo_is_full(&sample_fifo)) {
+        kfifo_skip(&sample_fifo);
+        sensor.fifo_overflows++;
+    }
+    kfifo_put(&sample_fifo, rec);
+    bh1750_publish_shared(&rec);
+    spin_unlock(&sensor.data_lock);
     return 0;
 }
 
-/* Timer refresh */
-static struct timer_list refresh_timer;
-static void sensor_refresh_callback(struct timer_list *t)
+/*
+ * Acquisition runs from a delayed work item so it may sleep on the bus and
+ * in msleep(); read() only ever copies the cached sample.
+ */
+static struct delayed_work refresh_work;
+static atomic_t refresh_requested = ATOMIC_INIT(0);
+
+static void sensor_refresh_work(struct work_struct *work)
 {
     unsigned int lux;
-    if (auto_refresh)
-        bh1750_read_lux_value(&lux);
-    mod_timer(&refresh_timer, jiffies + msecs_to_jiffies(refresh_interval));
+    int ret;
+
+    if (auto_refresh || atomic_xchg(&refresh_requested, 0)) {
+        atomic64_inc(auto_refresh ? &stats.timer_refreshes : &stats.demand_refreshes);
+        WRITE_ONCE(sensor.started, sensor.started + 1);
+        ret = bh1750_read_lux_value(&lux);
+        spin_lock(&sensor.data_lock);
+        sensor.attempts++;
+        sensor.last_error = ret;
+        spin_unlock(&sensor.data_lock);
+        wake_up_interruptible(&sensor.wq);
+    }
+    /* Never poll faster than the sensor converts */
+    schedule_delayed_work(&refresh_work,
+                          msecs_to_jiffies(max(refresh_interval,
+                                               bh1750_get_wait_time(meas_mode, mtreg))));
+}
+
+/* Ask the worker for a sample now (auto_refresh off) */
+static void bh1750_request_sample(void)
+{
+    atomic_set(&refresh_requested, 1);
+    mod_delayed_work(system_wq, &refresh_work, 0);
+}
+
+/* sensorhub: same demand path as read() with auto_refresh off */
+u32 bh1750_hub_trigger(void)
+{
+    u32 ticket = READ_ONCE(sensor.started) + 1;
+
+    bh1750_request_sample();
+    return ticket;
+}
+EXPORT_SYMBOL_GPL(bh1750_hub_trigger);
+
+int bh1750_hub_wait(u32 ticket, unsigned long timeout)
+{
+    long ret = wait_event_interruptible_timeout(sensor.wq,
+                   (s32)(READ_ONCE(sensor.attempts) - ticket) >= 0, timeout);
+
+    if (ret < 0)
+        return ret;
+    if (!ret)
+        return -ETIMEDOUT;
+    return READ_ONCE(sensor.last_error);
 }
+EXPORT_SYMBOL_GPL(bh1750_hub_wait);
+
+int bh1750_hub_latest(struct bh1750_record *rec)
+{
+    int ret;
+
+    memset(rec, 0, sizeof(*rec));
+    spin_lock(&sensor.data_lock);
+    rec->timestamp_ns = shared_page->timestamp_ns;
+    rec->seq = shared_page->seq;
+    rec->millilux = shared_page->millilux;
+    rec->raw = shared_page->raw;
+    ret = sensor.last_error;
+    spin_unlock(&sensor.data_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(bh1750_hub_latest);
 
 /* File operations */
 static int bh1750_dev_open(struct inode *inode, struct file *file)
 {
-    pr_info("BH1750: Device opened\n");
+    struct bh_file *bf = kzalloc(sizeof(*bf), GFP_KERNEL);
+
+    if (!bf)
+        return -ENOMEM;
+    /* On-demand mode: only samples taken after open() count as pending */
+    if (!auto_refresh)
+        bf->seen_seq = READ_ONCE(sensor.seq);
+    file->private_data = bf;
+    pr_debug("BH1750: Device opened\n");
     return 0;
 }
 
 static int bh1750_dev_close(struct inode *inode, struct file *file)
 {
-    pr_info("BH1750: Device closed\n");
+    kfree(file->private_data);
+    pr_debug("BH1750: Device closed\n");
     return 0;
 }
 
-static ssize_t bh1750_dev_read(struct file *file, char __user *buf, size_t count, loff_t *offset)
+/*
+ * Wait until there is a sample this file has not returned yet. With
+ * auto_refresh on, the first read after open returns the cached sample at
+ * once and later reads wait for the next refresh. With auto_refresh off
+ * a read returns a sample that is still pending for this file (e.g. one
+ * requested by an earlier O_NONBLOCK read), otherwise it asks the worker
+ * for a fresh one.
+ */
+static int bh1750_wait_sample(struct file *file, struct bh_file *bf)
 {
-    unsigned int lux;
+    u32 attempts;
     int ret;
-    char lux_str[32];
-    int len;
 
-    if (*offset > 0)
+    if (READ_ONCE(sensor.seq) != bf->seen_seq) {
+        atomic64_inc(&stats.cache_hits);
         return 0;
+    }
 
-    if (time_after(jiffies, sensor.last_update + msecs_to_jiffies(refresh_interval)) || !auto_refresh) {
-        ret = bh1750_read_lux_value(&lux);
-        if (ret < 0)
+    if (!auto_refresh) {
+        attempts = READ_ONCE(sensor.attempts);
+        bh1750_request_sample();
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(sensor.wq, READ_ONCE(sensor.attempts) != attempts);
+        if (ret)
+            return ret;
+        if (READ_ONCE(sensor.seq) == bf->seen_seq)
+            return READ_ONCE(sensor.last_error) ?: -EIO;
+        return 0;
+    }
+
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+    return wait_event_interruptible(sensor.wq, READ_ONCE(sensor.seq) != bf->seen_seq);
+}
+
+/*
+ * Binary format: drain as many whole records as fit in the buffer. Blocks
+ * only while the ring is empty, so a reader can sleep through many refresh
+ * periods and collect every sample in one call.
+ *
+ * There is one ring, not one per file: binary readers are consumers of the
+ * same queue (the logger is the intended single consumer). fifo_read_lock
+ * serializes the peek/copy/skip sequence so each record goes to exactly one
+ * reader. Records leave the ring only after they reached user space, so a
+ * faulting buffer loses nothing.
+ */
+static ssize_t bh1750_read_records(struct file *file, char __user *buf, size_t count)
+{
+    struct bh1750_record chunk[FIFO_CHUNK];
+    struct bh1750_record head;
+    size_t max_records = count / sizeof(struct bh1750_record);
+    size_t done = 0;
+    unsigned int n;
+    int ret;
+
+    if (!max_records)
+        return -EINVAL;
+
+again:
+    if (kfifo_is_empty(&sample_fifo)) {
+        if (!auto_refresh)
+            bh1750_request_sample();
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(sensor.wq, !kfifo_is_empty(&sample_fifo));
+        if (ret)
             return ret;
     } else {
-        lux = sensor.lux;
+        atomic64_inc(&stats.cache_hits);
+    }
+
+    ret = mutex_lock_interruptible(&fifo_read_lock);
+    if (ret)
+        return ret;
+    while (done < max_records) {
+        spin_lock(&sensor.data_lock);
+        n = kfifo_out_peek(&sample_fifo, chunk, min_t(size_t, FIFO_CHUNK, max_records - done));
+        spin_unlock(&sensor.data_lock);
+        if (!n)
+            break;
+        if (copy_to_user(buf + done * sizeof(chunk[0]), chunk, n * sizeof(chunk[0]))) {
+            ret = -EFAULT;
+            break;
+        }
+        /*
+         * Skip by sequence rather than by count: the producer may have
+         * dropped the oldest records meanwhile.
+         */
+        spin_lock(&sensor.data_lock);
+        while (kfifo_peek(&sample_fifo, &head) && (s32)(head.seq - chunk[n - 1].seq) <= 0)
+            kfifo_skip(&sample_fifo);
+        spin_unlock(&sensor.data_lock);
+        done += n;
     }
+    mutex_unlock(&fifo_read_lock);
 
-    len = snprintf(lux_str, sizeof(lux_str), "%u\n", lux);
+    if (done)
+        return done * sizeof(struct bh1750_record);
+    if (ret)
+        return ret;
+    /* Another reader drained the ring first */
+    goto again;
+}
+
+/*
+ * Output: "<lux> <timestamp_ns> <seq>\n". Readers that only parse the
+ * leading "%u" keep working; the timestamp and sequence number let user
+ * space trace a sample end to end.
+ */
+static ssize_t bh1750_dev_read(struct file *file, char __user *buf, size_t count, loff_t *offset)
+{
+    struct bh_file *bf = file->private_data;
+    unsigned int lux;
+    u64 timestamp_ns;
+    u32 seq;
+    int ret;
+    char lux_str[48];
+    int len;
+
+    atomic64_inc(&stats.reads);
+    if (bf->format == BH1750_FORMAT_BINARY)
+        return bh1750_read_records(file, buf, count);
+
+    ret = bh1750_wait_sample(file, bf);
+    if (ret)
+        return ret;
+
+    spin_lock(&sensor.data_lock);
+    lux = sensor.lux;
+    timestamp_ns = sensor.timestamp_ns;
+    seq = sensor.seq;
+    spin_unlock(&sensor.data_lock);
+
+    len = snprintf(lux_str, sizeof(lux_str), "%u %llu %u\n", lux, timestamp_ns, seq);
     if (len > count)
         return -EINVAL;
     if (copy_to_user(buf, lux_str, len))
         return -EFAULT;
 
+    bf->seen_seq = seq;
     *offset += len;
     return len;
 }
 
+static __poll_t bh1750_dev_poll(struct file *file, poll_table *wait)
+{
+    struct bh_file *bf = file->private_data;
+
+    poll_wait(file, &sensor.wq, wait);
+    if (bf->format == BH1750_FORMAT_BINARY) {
+        if (!kfifo_is_empty(&sample_fifo))
+            return EPOLLIN | EPOLLRDNORM;
+        return 0;
+    }
+    if (READ_ONCE(sensor.seq) != bf->seen_seq)
+        return EPOLLIN | EPOLLRDNORM;
+    return 0;
+}
+
+/* Map the latest-sample page read-only (see struct bh1750_shared) */
+static int bh1750_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vm_flags_clear(vma, VM_MAYWRITE);
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(shared_page) >> PAGE_SHIFT,
+                           PAGE_SIZE, vma->vm_page_prot);
+}
+
+/* Fill the derived fields of a configuration, called with sensor.lock held */
+static void bh1750_get_config(struct bh1750_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->mode = meas_mode;
+    cfg->mtreg = mtreg;
+    cfg->auto_range = auto_range;
+    cfg->conversion_us = bh1750_get_wait_time(meas_mode, mtreg) * USEC_PER_MSEC;
+    cfg->resolution_mlx = bh1750_raw_to_millilux(1, meas_mode, mtreg);
+    cfg->full_scale_mlx = bh1750_raw_to_millilux(0xffff, meas_mode, mtreg);
+}
+
+static int bh1750_set_config(struct bh1750_config __user *ucfg)
+{
+    struct bh1750_config cfg;
+
+    if (copy_from_user(&cfg, ucfg, sizeof(cfg)))
+        return -EFAULT;
+    if (!bh1750_is_valid_mode(cfg.mode) ||
+        cfg.mtreg < BH1750_MTREG_MIN || cfg.mtreg > BH1750_MTREG_MAX)
+        return -EINVAL;
+
+    mutex_lock(&sensor.lock);
+    meas_mode = cfg.mode;
+    mtreg = cfg.mtreg;
+    auto_range = cfg.auto_range;
+    /* Next acquisition reprograms MTreg and the mode */
+    sensor.initialized = false;
+    bh1750_get_config(&cfg);
+    mutex_unlock(&sensor.lock);
+
+    pr_info("BH1750: Mode 0x%02x, MTreg %u, auto-range %s\n",
+            cfg.mode, cfg.mtreg, cfg.auto_range ? "on" : "off");
+    mod_delayed_work(system_wq, &refresh_work, 0);
+    if (copy_to_user(ucfg, &cfg, sizeof(cfg)))
+        return -EFAULT;
+    return 0;
+}
+
+static long bh1750_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct bh_file *bf = file->private_data;
+    struct bh1750_fifo_status status;
+    struct bh1750_config cfg;
+    u32 format;
+
+    switch (cmd) {
+    case BH1750_IOC_SET_FORMAT:
+        if (get_user(format, (u32 __user *)arg))
+            return -EFAULT;
+        if (format != BH1750_FORMAT_TEXT && format != BH1750_FORMAT_BINARY)
+            return -EINVAL;
+        bf->format = format;
+        return 0;
+    case BH1750_IOC_FIFO_STATUS:
+        spin_lock(&sensor.data_lock);
+        status.level = kfifo_len(&sample_fifo);
+        status.capacity = kfifo_size(&sample_fifo);
+        status.overflows = sensor.fifo_overflows;
+        spin_unlock(&sensor.data_lock);
+        if (copy_to_user((void __user *)arg, &status, sizeof(status)))
+            return -EFAULT;
+        return 0;
+    case BH1750_IOC_FIFO_FLUSH:
+        spin_lock(&sensor.data_lock);
+        kfifo_reset_out(&sample_fifo);
+        spin_unlock(&sensor.data_lock);
+        return 0;
+    case BH1750_IOC_GET_CONFIG:
+        mutex_lock(&sensor.lock);
+        bh1750_get_config(&cfg);
+        mutex_unlock(&sensor.lock);
+        if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+            return -EFAULT;
+        return 0;
+    case BH1750_IOC_SET_CONFIG:
+        return bh1750_set_config((struct bh1750_config __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
 static ssize_t bh1750_dev_write(struct file *file, const char __user *buf, size_t count, loff_t *offset)
 {
     char kbuf[32];
@@ -328,6 +993,7 @@ static ssize_t bh1750_dev_write(struct file *file, const char __user *buf, size_
         return -EINVAL;
 
     refresh_interval = val;
+    mod_delayed_work(system_wq, &refresh_work, msecs_to_jiffies(refresh_interval));
     pr_info("BH1750: Refresh interval set to %u ms\n", refresh_interval);
     *offset = count;
     return count;
@@ -339,6 +1005,188 @@ static const struct file_operations bh1750_fops = {
     .release = bh1750_dev_close,
     .read = bh1750_dev_read,
     .write = bh1750_dev_write,
+    .poll = bh1750_dev_poll,
+    .unlocked_ioctl = bh1750_dev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .mmap = bh1750_dev_mmap,
+};
+
+/* Hardware I2C binding */
+static int bh1750_i2c_probe(struct i2c_client *client)
+{
+    if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C) &&
+        !i2c_check_functionality(client->adapter,
+                                 I2C_FUNC_SMBUS_WRITE_BYTE | I2C_FUNC_SMBUS_READ_WORD_DATA))
+        return -EOPNOTSUPP;
+
+    mutex_lock(&sensor.lock);
+    if (bh_client) {
+        mutex_unlock(&sensor.lock);
+        return -EBUSY;
+    }
+    bh_client = client;
+    sensor.initialized = false;
+    mutex_unlock(&sensor.lock);
+
+    dev_info(&client->dev, "BH1750: Bound to %s\n", client->adapter->name);
+    return 0;
+}
+
+static void bh1750_i2c_remove(struct i2c_client *client)
+{
+    mutex_lock(&sensor.lock);
+    if (bh_client == client) {
+        bh_client = NULL;
+        sensor.initialized = false;
+    }
+    mutex_unlock(&sensor.lock);
+}
+
+static const struct i2c_device_id bh1750_i2c_id[] = {
+    { I2C_CLIENT_NAME, 0 },
+    { }
+};
+MODULE_DEVICE_TABLE(i2c, bh1750_i2c_id);
+
+static const struct of_device_id bh1750_of_match[] = {
+    { .compatible = "bbb,bh1750" },
+    { }
+};
+MODULE_DEVICE_TABLE(of, bh1750_of_match);
+
+static struct i2c_driver bh1750_i2c_driver = {
+    .driver = {
+        .name = I2C_CLIENT_NAME,
+        .of_match_table = bh1750_of_match,
+    },
+    .probe = bh1750_i2c_probe,
+    .remove = bh1750_i2c_remove,
+    .id_table = bh1750_i2c_id,
+};
+
+/* Transport setup */
+static int bh1750_bitbang_setup(void)
+{
+    int ret;
+
+    ret = gpio1_claim(SCL_MASK | SDA_MASK, "bh1750");
+    if (ret)
+        return ret;
+    bb_claimed = true;
+
+    /* Open drain: output level stays 0, idle bus = both lines released */
+    gpio1_clear(SCL_MASK | SDA_MASK);
+    gpio1_input(SCL_MASK | SDA_MASK);
+    bb_calibrate();
+    return 0;
+}
+
+static int bh1750_i2c_setup(void)
+{
+    struct i2c_board_info info = { I2C_BOARD_INFO(I2C_CLIENT_NAME, BH1750_ADDR) };
+    struct i2c_adapter *adap;
+    int ret;
+
+    ret = i2c_add_driver(&bh1750_i2c_driver);
+    if (ret < 0)
+        return ret;
+
+    /* Without i2c_adapter the client comes from DT or .../new_device */
+    if (i2c_adapter < 0)
+        return 0;
+
+    adap = i2c_get_adapter(i2c_adapter);
+    if (!adap) {
+        pr_err("BH1750: I2C adapter %d not found\n", i2c_adapter);
+        i2c_del_driver(&bh1750_i2c_driver);
+        return -ENODEV;
+    }
+    bh_auto_client = i2c_new_client_device(adap, &info);
+    i2c_put_adapter(adap);
+    if (IS_ERR(bh_auto_client)) {
+        ret = PTR_ERR(bh_auto_client);
+        bh_auto_client = NULL;
+        i2c_del_driver(&bh1750_i2c_driver);
+        return ret;
+    }
+    return 0;
+}
+
+static void bh1750_bus_teardown(void)
+{
+    if (use_hw_i2c) {
+        if (bh_auto_client)
+            i2c_unregister_device(bh_auto_client);
+        i2c_del_driver(&bh1750_i2c_driver);
+    } else if (bb_claimed) {
+        gpio1_input(SCL_MASK | SDA_MASK);
+        gpio1_release(SCL_MASK | SDA_MASK);
+        bb_claimed = false;
+    }
+}
+
+/* debugfs: bh1750/stats */
+static int bh1750_stats_show(struct seq_file *m, void *v)
+{
+    u64 xfers = atomic64_read(&stats.xfers);
+    int i;
+
+    seq_printf(m, "bus:              %s\n", bus->name);
+    seq_printf(m, "reads:            %lld\n", atomic64_read(&stats.reads));
+    seq_printf(m, "cache_hits:       %lld\n", atomic64_read(&stats.cache_hits));
+    seq_printf(m, "nacks:            %lld\n", atomic64_read(&stats.nacks));
+    seq_printf(m, "reinits:          %lld\n", atomic64_read(&stats.reinits));
+    seq_printf(m, "timer_refreshes:  %lld\n", atomic64_read(&stats.timer_refreshes));
+    seq_printf(m, "demand_refreshes: %lld\n", atomic64_read(&stats.demand_refreshes));
+    seq_printf(m, "fifo_overflows:   %llu\n", READ_ONCE(sensor.fifo_overflows));
+    seq_printf(m, "xfers:            %llu\n", xfers);
+    seq_printf(m, "xfer_avg_ns:      %llu\n",
+               xfers ? div64_u64(atomic64_read(&stats.xfer_ns), xfers) : 0);
+    seq_puts(m, "xfer_us histogram:\n");
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        u64 n = atomic64_read(&stats.xfer_hist[i]);
+
+        if (!n)
+            continue;
+        if (i == STATS_HIST_BUCKETS - 1)
+            seq_printf(m, "  %6u+        %llu\n", 1U << i, n);
+        else
+            seq_printf(m, "  %6u-%-6u  %llu\n", i ? 1U << i : 0, (1U << (i + 1)) - 1, n);
+    }
+    return 0;
+}
+
+static int bh1750_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, bh1750_stats_show, NULL);
+}
+
+/* Any write clears the counters */
+static ssize_t bh1750_stats_write(struct file *file, const char __user *buf,
+                                  size_t count, loff_t *ppos)
+{
+    int i;
+
+    atomic64_set(&stats.reads, 0);
+    atomic64_set(&stats.cache_hits, 0);
+    atomic64_set(&stats.nacks, 0);
+    atomic64_set(&stats.reinits, 0);
+    atomic64_set(&stats.timer_refreshes, 0);
+    atomic64_set(&stats.demand_refreshes, 0);
+    atomic64_set(&stats.xfers, 0);
+    atomic64_set(&stats.xfer_ns, 0);
+    for (i = 0; i < STATS_HIST_BUCKETS; i++)
+        atomic64_set(&stats.xfer_hist[i], 0);
+    return count;
+}
+
+static const struct file_operations bh1750_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = bh1750_stats_open,
+    .read = seq_read,
+    .write = bh1750_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
 };
 
 /* Module init/exit */
@@ -347,26 +1195,32 @@ static int __init bh1750_init(void)
     int ret;
     dev_t devt;
 
-    /* Map GPIO */
-    gpio_base = ioremap(GPIO1_BASE_ADDR, GPIO_MEM_SIZE);
-    if (!gpio_base) {
-        pr_err("BH1750: Failed to ioremap GPIO base\n");
+    mutex_init(&sensor.lock);
+    spin_lock_init(&sensor.data_lock);
+    init_waitqueue_head(&sensor.wq);
+    INIT_KFIFO(sample_fifo);
+    /* Before the device is exposed: open()/read() may queue the work at once */
+    INIT_DELAYED_WORK(&refresh_work, sensor_refresh_work);
+    sensor.initialized = false;
+    sensor.lux = 0;
+
+    shared_page = (struct bh1750_shared *)get_zeroed_page(GFP_KERNEL);
+    if (!shared_page)
         return -ENOMEM;
-    }
 
-    /* Set GPIO pins to output and high */
-    {
-        u32 reg = ioread32(gpio_base + GPIO_OE_OFFSET);
-        reg &= ~(SCL_MASK | SDA_MASK); // output
-        iowrite32(reg, gpio_base + GPIO_OE_OFFSET);
-        iowrite32(SCL_MASK | SDA_MASK, gpio_base + GPIO_SET_OFFSET);
+    bus = use_hw_i2c ? &hw_bus : &bitbang_bus;
+    ret = use_hw_i2c ? bh1750_i2c_setup() : bh1750_bitbang_setup();
+    if (ret < 0) {
+        free_page((unsigned long)shared_page);
+        return ret;
     }
 
     /* Register char device */
     ret = alloc_chrdev_region(&devt, 0, 1, DEVICE_NAME);
     if (ret < 0) {
         pr_err("BH1750: Failed to alloc chrdev\n");
-        iounmap(gpio_base);
+        bh1750_bus_teardown();
+        free_page((unsigned long)shared_page);
         return ret;
     }
     major = MAJOR(devt);
@@ -376,7 +1230,8 @@ static int __init bh1750_init(void)
     ret = cdev_add(&bh_cdev, devt, 1);
     if (ret < 0) {
         unregister_chrdev_region(devt, 1);
-        iounmap(gpio_base);
+        bh1750_bus_teardown();
+        free_page((unsigned long)shared_page);
         return ret;
     }
 
@@ -384,7 +1239,8 @@ static int __init bh1750_init(void)
     if (IS_ERR(bh_class)) {
         cdev_del(&bh_cdev);
         unregister_chrdev_region(devt, 1);
-        iounmap(gpio_base);
+        bh1750_bus_teardown();
+        free_page((unsigned long)shared_page);
         return PTR_ERR(bh_class);
     }
 
@@ -393,25 +1249,27 @@ static int __init bh1750_init(void)
         class_destroy(bh_class);
         cdev_del(&bh_cdev);
         unregister_chrdev_region(devt, 1);
-        iounmap(gpio_base);
+        bh1750_bus_teardown();
+        free_page((unsigned long)shared_page);
         return PTR_ERR(bh_device);
     }
 
-    mutex_init(&sensor.lock);
-    sensor.initialized = false;
-    sensor.lux = 0;
+    /* debugfs is best effort, the driver works without it */
+    debug_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+    debugfs_create_file("stats", 0600, debug_dir, NULL, &bh1750_stats_fops);
 
-    timer_setup(&refresh_timer, sensor_refresh_callback, 0);
-    mod_timer(&refresh_timer, jiffies + msecs_to_jiffies(refresh_interval));
+    /* First sample right away so early readers do not wait a full interval */
+    schedule_delayed_work(&refresh_work, 0);
 
-    pr_info("BH1750: Module loaded, major=%d\n", major);
+    pr_info("BH1750: Module loaded, major=%d, bus=%s\n", major, bus->name);
     return 0;
 }
 
 static void __exit bh1750_exit(void)
 {
     dev_t devt = MKDEV(major, 0);
-    del_timer_sync(&refresh_timer);
+    cancel_delayed_work_sync(&refresh_work);
+    debugfs_remove_recursive(debug_dir);
 
     if (bh_device)
         device_destroy(bh_class, devt);
@@ -421,8 +1279,8 @@ static void __exit bh1750_exit(void)
     cdev_del(&bh_cdev);
     unregister_chrdev_region(devt, 1);
 
-    if (gpio_base)
-        iounmap(gpio_base);
+    bh1750_bus_teardown();
+    free_page((unsigned long)shared_page);
 
     pr_info("BH1750: Module unloaded\n");
 }
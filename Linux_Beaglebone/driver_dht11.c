@@ -3,167 +3,474 @@
 #include <linux/fs.h>
 #include <linux/device.h>
 #include <linux/uaccess.h>
-#include <linux/io.h>
 #include <linux/cdev.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/timekeeping.h>
+#include <linux/mm.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+
+#include "include/dht11.h"
+#include "gpio1_core.h"
+#include "sensorhub_sources.h"
+
+#define CREATE_TRACE_POINTS
+#include "dht11_trace.h"
 
 #define DEVICE_NAME "dht11"
 #define CLASS_NAME  "dht_class"
-#define BUFFER_SIZE 64 // byte
-#define GPIO1_BASE   0x4804C000
-#define GPIO_SIZE    0x1000
-#define GPIO_OE      0x134
-#define GPIO_DATAIN  0x138
-#define GPIO_DATAOUT 0x13C
+#define BUFFER_SIZE 96 // byte
 #define GPIO_DHT11   13   
 #define TIMEOUT_US   1000 // microseconds
+#define DEFAULT_SAMPLE_INTERVAL_MS 2000
+#define DHT11_MIN_INTERVAL_MS 1000 // Datasheet: at least 1 s between conversions
+#define BIT_TIMEOUT_US 100 // Longest wait for one level inside a data bit
+
+// IRQ decoder: falling edges are response start, end of response, then one
+// per data bit; the gap between two falling edges is 50us low + the bit's
+// high time (26-28us for 0, 70us for 1)
+#define DHT11_EDGES          42
+#define DHT11_BIT_THRESHOLD_US 100
+#define DHT11_MIN_GAP_US     40
+#define DHT11_MAX_GAP_US     200
+#define DHT11_IRQ_TIMEOUT_MS 20  /* Frame takes ~5 ms */
 
 static int major_number;
 static struct class *dev_class = NULL;
 static struct device *dev_device = NULL;
-static void __iomem *gpio_base = NULL;
-static char result_buffer[BUFFER_SIZE];
-static DEFINE_MUTEX(dht11_mutex);
+static DEFINE_MUTEX(dht11_mutex);      // Serializes sensor transactions
+
+// Latest sample, written by the sampling worker and copied out by readers
+static DEFINE_SPINLOCK(dht11_lock);
+static u8 dht11_data[5];
+static u64 dht11_timestamp_ns;  // CLOCK_REALTIME of last successful read
+static ktime_t dht11_taken;     // CLOCK_MONOTONIC of the same read, for the sample age
+static u32 dht11_seq;           // Incremented on every successful read
+static u32 dht11_attempts;      // Incremented on every read, successful or not
+static u32 dht11_started;       // Incremented when a read starts, for sensorhub tickets
+static ktime_t dht11_started_at;
+static int dht11_last_error;
+static DECLARE_WAIT_QUEUE_HEAD(dht11_wq);  // Woken after every attempt
+static struct delayed_work sample_work;
+
+// Per-open state: what this file has already returned
+struct dht11_file {
+    u32 seen_seq;
+    u32 seen_attempts;
+    u32 format;                 // DHT11_FORMAT_*
+};
+static struct dht11_shared *shared_page;  // mmap()ed latest sample
+static u32 dht11_mask;          // Our bit in the GPIO1 registers
+
+static int gpio_num = GPIO1_FIRST + GPIO_DHT11;
+module_param(gpio_num, int, 0444);
+MODULE_PARM_DESC(gpio_num, "GPIO number of the DHT11 data line (GPIO1 bank only)");
+static bool use_irq = true;
+module_param(use_irq, bool, 0644);
+MODULE_PARM_DESC(use_irq, "Decode from edge interrupts instead of busy polling");
+static unsigned int sample_interval_ms = DEFAULT_SAMPLE_INTERVAL_MS;
+module_param(sample_interval_ms, uint, 0644);
+MODULE_PARM_DESC(sample_interval_ms, "Background sampling period in ms (at least 1000)");
+
+// Edge capture, filled by dht11_irq_handler() while dht11_capturing is set
+static int dht11_irq = -1;
+static ktime_t dht11_edges[DHT11_EDGES];
+static unsigned int dht11_nedges;
+static bool dht11_capturing;
+static s64 dht11_irq_ns;        // Time spent in the handler for this read
+static DECLARE_COMPLETION(dht11_done);
+
+// Per-mode statistics (index 0 = polling, 1 = irq), protected by dht11_mutex
+struct dht11_mode_stats {
+    u64 reads;
+    u64 checksum_errors;
+    u64 other_errors;
+    u64 busy_ns;                // CPU time spent in the read, sleeps excluded
+};
+static struct dht11_mode_stats dht11_stats[2];
+static struct dentry *debug_dir;
 
 static int device_open(struct inode *, struct file *);
 static int device_release(struct inode *, struct file *);
 static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
+static __poll_t device_poll(struct file *, poll_table *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
+static int device_mmap(struct file *, struct vm_area_struct *);
 
 static struct file_operations fops = {
+    .owner = THIS_MODULE,
     .open = device_open,
     .release = device_release,
     .read = device_read,
+    .poll = device_poll,
+    .unlocked_ioctl = device_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .mmap = device_mmap,
 };
 
 // Set GPIO pin as output
+// OE is shared with the LED and BH1750 pins, gpio1_core serializes the update
 static void dht11_set_output(void) {
-    u32 val = ioread32(gpio_base + GPIO_OE);
-    val &= ~(1 << GPIO_DHT11);
-    iowrite32(val, gpio_base + GPIO_OE);
+    gpio1_output(dht11_mask);
 }
 
 // Set GPIO pin as input
 static void dht11_set_input(void) {
-    u32 val = ioread32(gpio_base + GPIO_OE);
-    val |= (1 << GPIO_DHT11);
-    iowrite32(val, gpio_base + GPIO_OE);
+    gpio1_input(dht11_mask);
 }
 
 // Write GPIO value
 static void gpio_write(int value)
 {
-    u32 val = ioread32(gpio_base + GPIO_DATAOUT);
     if (value)
-        val |= (1 << GPIO_DHT11);
+        gpio1_set(dht11_mask);
     else
-        val &= ~(1 << GPIO_DHT11);
-    iowrite32(val, gpio_base + GPIO_DATAOUT);
+        gpio1_clear(dht11_mask);
 }
 
 // Read GPIO value
 static int gpio_read(void) {
-    u32 val = ioread32(gpio_base + GPIO_DATAIN);
-    return (val & (1 << GPIO_DHT11)) ? 1 : 0;
+    return (gpio1_read_in() & dht11_mask) ? 1 : 0;
 }
 
 // Wait for GPIO signal with timeout
 static int wait_gpio(int value, unsigned long timeout_us) {
-    unsigned long start = jiffies;
+    ktime_t deadline = ktime_add_us(ktime_get(), timeout_us);
     while (gpio_read() != value) {
-        if (time_after(jiffies, start + usecs_to_jiffies(timeout_us))) {
-            printk(KERN_ERR "DHT11: Timeout waiting for GPIO %d to be %d\n", GPIO_DHT11, value);
+        if (ktime_after(ktime_get(), deadline))
             return -ETIMEDOUT;
-        }
         udelay(1);
     }
     return 0;
 }
 
-// Read temperature and humidity data from DHT11
-static int dht11_read_raw(u8 data[5]) {
-    int i, j;
-    u8 byte = 0;
-
-    mutex_lock(&dht11_mutex);
-    memset(data, 0, 5);
-
-    printk(KERN_INFO "DHT11: Starting communication\n");
+// Seqlock writer for the mmap page, called with dht11_mutex held
+static void dht11_publish_shared(const u8 data[5]) {
+    WRITE_ONCE(shared_page->sequence, shared_page->sequence + 1);
+    smp_wmb();
+    shared_page->seq = dht11_seq;
+    shared_page->timestamp_ns = dht11_timestamp_ns;
+    shared_page->temp_decicelsius = data[2] * 10 + data[3];
+    shared_page->hum_decipercent = data[0] * 10 + data[1];
+    memcpy(shared_page->raw, data, 5);
+    smp_wmb();
+    WRITE_ONCE(shared_page->sequence, shared_page->sequence + 1);
+}
 
-    // Check initial GPIO state
-    dht11_set_input();
-    if (!gpio_read()) {
-        mutex_unlock(&dht11_mutex);
-        printk(KERN_ERR "DHT11: GPIO %d stuck LOW, possible hardware issue\n", GPIO_DHT11);
-        return -EIO;
-    }
+// Polling decoder: busy-waits for the whole transaction (~22 ms)
+static int dht11_read_poll(u8 data[5]) {
+    bool timing = trace_dht11_byte_enabled();
+    ktime_t t, t_low, t_byte, t_rise = 0;
+    u32 margin;
+    int i, j, high_us;
+    u8 byte = 0;
 
     // Start
     dht11_set_output();
     gpio_write(0);
+    t = ktime_get();
     mdelay(18);
     gpio_write(1);
+    trace_dht11_start(false, ktime_us_delta(ktime_get(), t));
+    t = ktime_get();
     udelay(30);
 
     dht11_set_input();
 
     // Wait time
     if (wait_gpio(0, 80)) {
-        mutex_unlock(&dht11_mutex);
-        printk(KERN_ERR "DHT11: No response (LOW)\n");
+        trace_dht11_error(DHT11_STAGE_RESPONSE_LOW, -1, -ETIMEDOUT);
         return -ETIMEDOUT;
     }
+    t_low = ktime_get();
     udelay(80);
     if (wait_gpio(1, 80)) {
-        mutex_unlock(&dht11_mutex);
-        printk(KERN_ERR "DHT11: No response (HIGH)\n");
+        trace_dht11_error(DHT11_STAGE_RESPONSE_HIGH, -1, -ETIMEDOUT);
         return -ETIMEDOUT;
     }
     udelay(80);
+    trace_dht11_response(ktime_us_delta(t_low, t), ktime_us_delta(ktime_get(), t_low));
 
     // Read data 
     for (i = 0; i < 5; i++) {
+        t_byte = ktime_get();
+        margin = U32_MAX;
         for (j = 0; j < 8; j++) {
-            if (wait_gpio(1, 50)) {
-                mutex_unlock(&dht11_mutex);
-                printk(KERN_ERR "DHT11: Timeout waiting for HIGH bit\n");
+            if (wait_gpio(1, BIT_TIMEOUT_US)) {
+                trace_dht11_error(DHT11_STAGE_BIT_HIGH, i * 8 + j, -ETIMEDOUT);
                 return -ETIMEDOUT;
             }
+            if (timing)
+                t_rise = ktime_get();
             udelay(30);
             byte = (byte << 1) | (gpio_read() ? 1 : 0);
-            if (wait_gpio(0, 50)) {
-                mutex_unlock(&dht11_mutex);
-                printk(KERN_ERR "DHT11: Timeout waiting for LOW bit\n");
+            if (wait_gpio(0, BIT_TIMEOUT_US)) {
+                trace_dht11_error(DHT11_STAGE_BIT_LOW, i * 8 + j, -ETIMEDOUT);
                 return -ETIMEDOUT;
             }
+            if (timing) {
+                high_us = ktime_us_delta(ktime_get(), t_rise);
+                margin = min_t(u32, margin, abs(high_us - 30));
+            }
         }
         data[i] = byte;
+        trace_dht11_byte(i, byte, ktime_us_delta(ktime_get(), t_byte), timing ? margin : 0);
+    }
+    return 0;
+}
+
+// Timestamp every falling edge while a capture is running
+static irqreturn_t dht11_irq_handler(int irq, void *dev_id) {
+    ktime_t now = ktime_get();
+    unsigned int n;
+
+    if (!READ_ONCE(dht11_capturing))
+        return IRQ_HANDLED;
+    n = dht11_nedges;
+    if (n < DHT11_EDGES) {
+        dht11_edges[n] = now;
+        dht11_nedges = n + 1;
+        if (n + 1 == DHT11_EDGES)
+            complete(&dht11_done);
+    }
+    dht11_irq_ns += ktime_to_ns(ktime_sub(ktime_get(), now));
+    return IRQ_HANDLED;
+}
+
+// Classify the 40 data bits by the gap between consecutive falling edges
+static int dht11_decode_edges(u8 data[5]) {
+    int i, j, bit;
+    s64 gap;
+    u32 margin;
+
+    for (i = 0; i < 5; i++) {
+        margin = U32_MAX;
+        for (j = 0; j < 8; j++) {
+            bit = i * 8 + j;
+            gap = ktime_us_delta(dht11_edges[bit + 2], dht11_edges[bit + 1]);
+            if (gap < DHT11_MIN_GAP_US || gap > DHT11_MAX_GAP_US) {
+                trace_dht11_error(DHT11_STAGE_PULSE, bit, -EIO);
+                return -EIO;
+            }
+            data[i] = (data[i] << 1) | (gap > DHT11_BIT_THRESHOLD_US);
+            margin = min_t(u32, margin, abs((int)gap - DHT11_BIT_THRESHOLD_US));
+        }
+        trace_dht11_byte(i, data[i],
+                         ktime_us_delta(dht11_edges[i * 8 + 9], dht11_edges[i * 8 + 1]), margin);
+    }
+    return 0;
+}
+
+// IRQ decoder: sleeps through the start pulse and the transfer, the CPU is
+// only busy in the edge handler and the decode. *idle_ns gets the sleep time.
+static int dht11_read_irq(u8 data[5], s64 *idle_ns) {
+    ktime_t t;
+    unsigned long left;
+
+    // Start
+    dht11_set_output();
+    gpio_write(0);
+    t = ktime_get();
+    usleep_range(18000, 20000);
+    *idle_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+    trace_dht11_start(true, ktime_us_delta(ktime_get(), t));
+
+    reinit_completion(&dht11_done);
+    dht11_nedges = 0;
+    dht11_irq_ns = 0;
+    WRITE_ONCE(dht11_capturing, true);
+    dht11_set_input();  // Release, the pull-up takes the line high
+
+    t = ktime_get();
+    // +1: at HZ=100 a bare 1-jiffy wait can end right at the next tick
+    left = wait_for_completion_timeout(&dht11_done, msecs_to_jiffies(DHT11_IRQ_TIMEOUT_MS) + 1);
+    WRITE_ONCE(dht11_capturing, false);
+    synchronize_irq(dht11_irq);
+    *idle_ns += ktime_to_ns(ktime_sub(ktime_get(), t)) - dht11_irq_ns;
+
+    if (!left) {
+        trace_dht11_error(DHT11_STAGE_EDGES, dht11_nedges, -ETIMEDOUT);
+        return -ETIMEDOUT;
+    }
+    trace_dht11_response(ktime_us_delta(dht11_edges[0], t),
+                         ktime_us_delta(dht11_edges[1], dht11_edges[0]));
+    return dht11_decode_edges(data);
+}
+
+// Read temperature and humidity data from DHT11
+static int dht11_read_raw(u8 data[5]) {
+    bool irq_mode = use_irq && dht11_irq >= 0;
+    struct dht11_mode_stats *st = &dht11_stats[irq_mode];
+    s64 idle_ns = 0;
+    ktime_t start;
+    bool ok;
+    int ret;
+
+    mutex_lock(&dht11_mutex);
+    memset(data, 0, 5);
+
+    // Check initial GPIO state
+    dht11_set_input();
+    if (!gpio_read()) {
+        mutex_unlock(&dht11_mutex);
+        trace_dht11_error(DHT11_STAGE_IDLE, -1, -EIO);
+        return -EIO;
+    }
+
+    pr_debug("DHT11: Starting communication\n");
+    start = ktime_get();
+    ret = irq_mode ? dht11_read_irq(data, &idle_ns) : dht11_read_poll(data);
+    st->reads++;
+    st->busy_ns += ktime_to_ns(ktime_sub(ktime_get(), start)) - idle_ns;
+    if (ret < 0) {
+        st->other_errors++;
+        mutex_unlock(&dht11_mutex);
+        return ret;
     }
 
     // Byte Checksum
-    if ((u8)(data[0] + data[1] + data[2] + data[3]) != data[4]) {
+    ok = (u8)(data[0] + data[1] + data[2] + data[3]) == data[4];
+    trace_dht11_checksum(data, ok, ktime_us_delta(ktime_get(), start));
+    if (!ok) {
+        pr_debug("DHT11: Checksum error\n");
+        st->checksum_errors++;
         mutex_unlock(&dht11_mutex);
-        printk(KERN_ERR "DHT11: Checksum error\n");
         return -EIO;
     }
 
+    spin_lock(&dht11_lock);
+    memcpy(dht11_data, data, 5);
+    dht11_timestamp_ns = ktime_get_real_ns();
+    dht11_taken = ktime_get();
+    dht11_seq++;
+    spin_unlock(&dht11_lock);
+    dht11_publish_shared(data);
     mutex_unlock(&dht11_mutex);
-    printk(KERN_INFO "DHT11: Read successful\n");
+    pr_debug("DHT11: Read successful\n");
     return 0;
 }
 
+// Background sampling: readers never touch the sensor themselves
+static void dht11_sample_work(struct work_struct *work) {
+    u8 data[5];
+    int ret;
+
+    spin_lock(&dht11_lock);
+    dht11_started++;
+    dht11_started_at = ktime_get();
+    spin_unlock(&dht11_lock);
+
+    ret = dht11_read_raw(data);
+
+    spin_lock(&dht11_lock);
+    dht11_attempts++;
+    dht11_last_error = ret;
+    spin_unlock(&dht11_lock);
+    wake_up_interruptible(&dht11_wq);
+
+    schedule_delayed_work(&sample_work,
+                          msecs_to_jiffies(max_t(unsigned int, sample_interval_ms,
+                                                 DHT11_MIN_INTERVAL_MS)));
+}
+
+// Request the data line's interrupt; without it (or on the simulated
+// bank) only polling mode works
+static int dht11_setup_irq(void) {
+    int ret, irq;
+
+    irq = gpio1_to_irq(dht11_mask);
+    if (irq < 0)
+        return irq;
+    ret = request_irq(irq, dht11_irq_handler, IRQF_TRIGGER_FALLING, DEVICE_NAME, NULL);
+    if (ret)
+        return ret;
+    dht11_irq = irq;
+    return 0;
+}
+
+static void dht11_release_irq(void) {
+    if (dht11_irq < 0)
+        return;
+    free_irq(dht11_irq, NULL);
+    dht11_irq = -1;
+}
+
+// debugfs: dht11/stats, any write clears the counters
+static int dht11_stats_show(struct seq_file *m, void *v) {
+    static const char *const names[] = { "poll", "irq" };
+    int i;
+
+    mutex_lock(&dht11_mutex);
+    seq_printf(m, "active: %s\n", use_irq && dht11_irq >= 0 ? "irq" : "poll");
+    seq_puts(m, "mode  reads  checksum_err  other_err  checksum_fail  busy_us/read\n");
+    for (i = 0; i < 2; i++) {
+        struct dht11_mode_stats *st = &dht11_stats[i];
+        u64 rate = st->reads ? div64_u64(st->checksum_errors * 10000, st->reads) : 0;
+
+        seq_printf(m, "%-4s  %5llu  %12llu  %9llu  %9llu.%02llu%%  %12llu\n",
+                   names[i], st->reads, st->checksum_errors, st->other_errors,
+                   rate / 100, rate % 100,
+                   st->reads ? div64_u64(st->busy_ns, st->reads * NSEC_PER_USEC) : 0);
+    }
+    mutex_unlock(&dht11_mutex);
+    return 0;
+}
+
+static int dht11_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, dht11_stats_show, NULL);
+}
+
+static ssize_t dht11_stats_write(struct file *file, const char __user *buf,
+                                 size_t count, loff_t *ppos) {
+    mutex_lock(&dht11_mutex);
+    memset(dht11_stats, 0, sizeof(dht11_stats));
+    mutex_unlock(&dht11_mutex);
+    return count;
+}
+
+static const struct file_operations dht11_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = dht11_stats_open,
+    .read = seq_read,
+    .write = dht11_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
 static int __init device_init(void) {
+    int ret;
+
     printk(KERN_INFO "Initializing DHT11 Driver\n");
 
+    if (gpio_num < GPIO1_FIRST || gpio_num >= GPIO1_FIRST + 32) {
+        printk(KERN_ERR "DHT11: gpio_num %d is not on GPIO1\n", gpio_num);
+        return -EINVAL;
+    }
+    dht11_mask = 1 << (gpio_num - GPIO1_FIRST);
+
+    shared_page = (struct dht11_shared *)get_zeroed_page(GFP_KERNEL);
+    if (!shared_page)
+        return -ENOMEM;
+
     major_number = register_chrdev(0, DEVICE_NAME, &fops);
     if (major_number < 0) {
         printk(KERN_ERR "DHT11: Failed to register major number\n");
+        free_page((unsigned long)shared_page);
         return major_number;
     }
 
     dev_class = class_create(CLASS_NAME);
     if (IS_ERR(dev_class)) {
         unregister_chrdev(major_number, DEVICE_NAME);
+        free_page((unsigned long)shared_page);
         return PTR_ERR(dev_class);
     }
 
@@ -171,67 +478,203 @@ static int __init device_init(void) {
     if (IS_ERR(dev_device)) {
         class_destroy(dev_class);
         unregister_chrdev(major_number, DEVICE_NAME);
+        free_page((unsigned long)shared_page);
         return PTR_ERR(dev_device);
     }
 
-    gpio_base = ioremap(GPIO1_BASE, GPIO_SIZE);
-    if (!gpio_base) {
+    ret = gpio1_claim(dht11_mask, DEVICE_NAME);
+    if (ret) {
         device_destroy(dev_class, MKDEV(major_number, 0));
         class_destroy(dev_class);
         unregister_chrdev(major_number, DEVICE_NAME);
-        printk(KERN_ERR "DHT11: Failed to map GPIO memory\n");
-        return -ENOMEM;
+        free_page((unsigned long)shared_page);
+        return ret;
     }
 
     // Config GPIO input
     dht11_set_input();
+    if (dht11_setup_irq())
+        printk(KERN_WARNING "DHT11: No IRQ for GPIO %d, using polling\n", gpio_num);
+
+    debug_dir = debugfs_create_dir(DEVICE_NAME, NULL);
+    debugfs_create_file("stats", 0600, debug_dir, NULL, &dht11_stats_fops);
+
+    INIT_DELAYED_WORK(&sample_work, dht11_sample_work);
+    schedule_delayed_work(&sample_work, 0);
     printk(KERN_INFO "DHT11 Driver loaded successfully\n");
     return 0;
 }
 
 static void __exit device_exit(void) {
-    iounmap(gpio_base);
+    cancel_delayed_work_sync(&sample_work);
+    debugfs_remove_recursive(debug_dir);
+    dht11_release_irq();
+    gpio1_release(dht11_mask);
     device_destroy(dev_class, MKDEV(major_number, 0));
     class_destroy(dev_class);
     unregister_chrdev(major_number, DEVICE_NAME);
+    free_page((unsigned long)shared_page);
     printk(KERN_INFO "DHT11 Driver unloaded\n");
 }
 
 static int device_open(struct inode *inodep, struct file *filep) {
+    struct dht11_file *df = kzalloc(sizeof(*df), GFP_KERNEL);
+
+    if (!df)
+        return -ENOMEM;
+    filep->private_data = df;
     printk(KERN_INFO "DHT11 device opened\n");
     return 0;
 }
 
 static int device_release(struct inode *inodep, struct file *filep) {
+    kfree(filep->private_data);
     printk(KERN_INFO "DHT11 device closed\n");
     return 0;
 }
 
-static ssize_t device_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset) {
-    u8 data[5];
-    int temp, hum, ret;
-    int out_len;
+// A sample this file has not returned yet, or a failure while nothing was ever sampled
+static bool dht11_has_news(struct dht11_file *df) {
+    u32 seq = READ_ONCE(dht11_seq);
 
-    if (*offset > 0)
-        return 0;
+    return seq != df->seen_seq || (!seq && READ_ONCE(dht11_attempts) != df->seen_attempts);
+}
 
-    ret = dht11_read_raw(data);
-    if (ret < 0) {
-        snprintf(result_buffer, BUFFER_SIZE, "Error reading DHT11 (%d)\n", ret);
-    } else {
-        hum = data[0];
-        temp = data[2];
-        snprintf(result_buffer, BUFFER_SIZE, "Temp: %dC, Hum: %d%%\n", temp, hum);
+// Copy the cached sample, also returns the attempt count it belongs to
+static u32 dht11_snapshot(struct dht11_record *rec) {
+    ktime_t taken;
+    u32 attempts;
+
+    memset(rec, 0, sizeof(*rec));
+    spin_lock(&dht11_lock);
+    memcpy(rec->raw, dht11_data, 5);
+    rec->timestamp_ns = dht11_timestamp_ns;
+    rec->seq = dht11_seq;
+    rec->error = dht11_last_error;
+    taken = dht11_taken;
+    attempts = dht11_attempts;
+    spin_unlock(&dht11_lock);
+
+    rec->temp_decicelsius = rec->raw[2] * 10 + rec->raw[3];
+    rec->hum_decipercent = rec->raw[0] * 10 + rec->raw[1];
+    if (rec->seq)
+        rec->age_ms = ktime_ms_delta(ktime_get(), taken);
+    return attempts;
+}
+
+// sensorhub: run the worker now, or as soon as the minimum interval allows
+u32 dht11_hub_trigger(void) {
+    s64 wait_ms;
+    u32 ticket;
+
+    spin_lock(&dht11_lock);
+    ticket = dht11_started + 1;
+    wait_ms = dht11_started ? DHT11_MIN_INTERVAL_MS -
+                              ktime_ms_delta(ktime_get(), dht11_started_at) : 0;
+    spin_unlock(&dht11_lock);
+
+    mod_delayed_work(system_wq, &sample_work, wait_ms > 0 ? msecs_to_jiffies(wait_ms) : 0);
+    return ticket;
+}
+EXPORT_SYMBOL_GPL(dht11_hub_trigger);
+
+int dht11_hub_wait(u32 ticket, unsigned long timeout) {
+    long ret = wait_event_interruptible_timeout(dht11_wq,
+                   (s32)(READ_ONCE(dht11_attempts) - ticket) >= 0, timeout);
+
+    if (ret < 0)
+        return ret;
+    if (!ret)
+        return -ETIMEDOUT;
+    return READ_ONCE(dht11_last_error);
+}
+EXPORT_SYMBOL_GPL(dht11_hub_wait);
+
+int dht11_hub_latest(struct dht11_record *rec) {
+    dht11_snapshot(rec);
+    return rec->error;
+}
+EXPORT_SYMBOL_GPL(dht11_hub_latest);
+
+// The first read after open returns the cached sample at once, later reads
+// wait for the worker's next one. age_ms tells how old the sample is.
+static ssize_t device_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset) {
+    struct dht11_file *df = filep->private_data;
+    struct dht11_record rec;
+    char result[BUFFER_SIZE];
+    const void *out = result;
+    u32 attempts;
+    int ret, out_len;
+
+    if (df->format == DHT11_FORMAT_BINARY && len < sizeof(rec))
+        return -EINVAL;
+
+    if (!dht11_has_news(df)) {
+        if (filep->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(dht11_wq, dht11_has_news(df));
+        if (ret)
+            return ret;
     }
 
-    out_len = strlen(result_buffer);
-    if (copy_to_user(buffer, result_buffer, out_len) != 0)
+    attempts = dht11_snapshot(&rec);
+    if (df->format == DHT11_FORMAT_BINARY) {
+        out = &rec;
+        out_len = sizeof(rec);
+    } else if (!rec.seq) {
+        out_len = snprintf(result, sizeof(result), "Error reading DHT11 (%d)\n", rec.error);
+    } else {
+        // Timestamp and sequence number let user space trace the sample end to end
+        out_len = snprintf(result, sizeof(result),
+                           "Temp: %dC, Hum: %d%%, ts: %llu, seq: %u, age_ms: %u\n",
+                           rec.raw[2], rec.raw[0], rec.timestamp_ns, rec.seq, rec.age_ms);
+    }
+    if (out_len > len)
+        return -EINVAL;
+    if (copy_to_user(buffer, out, out_len) != 0)
         return -EFAULT;
 
+    df->seen_seq = rec.seq;
+    df->seen_attempts = attempts;
     *offset += out_len;
     return out_len;
 }
 
+static __poll_t device_poll(struct file *filep, poll_table *wait) {
+    struct dht11_file *df = filep->private_data;
+
+    poll_wait(filep, &dht11_wq, wait);
+    return dht11_has_news(df) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static long device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct dht11_file *df = filep->private_data;
+    u32 format;
+
+    switch (cmd) {
+    case DHT11_IOC_SET_FORMAT:
+        if (get_user(format, (u32 __user *)arg))
+            return -EFAULT;
+        if (format != DHT11_FORMAT_TEXT && format != DHT11_FORMAT_BINARY)
+            return -EINVAL;
+        df->format = format;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+// Map the latest-sample page read-only (see struct dht11_shared)
+static int device_mmap(struct file *filep, struct vm_area_struct *vma) {
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vm_flags_clear(vma, VM_MAYWRITE);
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(shared_page) >> PAGE_SHIFT,
+                           PAGE_SIZE, vma->vm_page_prot);
+}
+
 module_init(device_init);
 module_exit(device_exit);
 
@@ -3,66 +3,152 @@
 #include <linux/fs.h>
 #include <linux/device.h>
 #include <linux/uaccess.h>
-#include <linux/io.h>
 #include <linux/cdev.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/timekeeping.h>
+
+#include "include/led.h"
+#include "gpio1_core.h"
+#include "sensorhub_sources.h"
 
 #define DEVICE_NAME "led"
 #define CLASS_NAME "led_class"
 
-#define GPIO1_BASE 0x4804C000
-#define GPIO_SIZE  0x1000
-
-#define GPIO_OE       0x134
-#define GPIO_DATAOUT  0x13C
-
 #define GPIO_LED_WEB     28  // GPIO1_28 = GPIO60
 #define GPIO_LED_TEMP    29  // GPIO1_29 = GPIO61
+#define LED_PINS ((1 << GPIO_LED_WEB) | (1 << GPIO_LED_TEMP))
 
 static int major_number;
 static struct class *led_class = NULL;
 static struct device *led_device = NULL;
 
-static void __iomem *gpio_base = NULL;
+// Generation tăng mỗi khi state word thay đổi, reader chờ trên led_wq
+static DEFINE_MUTEX(led_lock);  // gpio1_core có thể ngủ (backend gpio-sim)
+static u32 led_generation = 1;
+static u64 led_changed_ns;  // CLOCK_REALTIME của lần đổi trạng thái gần nhất
+static DECLARE_WAIT_QUEUE_HEAD(led_wq);
+
+// Trạng thái riêng của mỗi file mở: generation đã trả về
+struct led_file {
+    u32 seen_gen;
+};
 
 static int device_open(struct inode *, struct file *);
 static int device_release(struct inode *, struct file *);
 static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
 static ssize_t device_write(struct file *, const char __user *, size_t, loff_t *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
+static __poll_t device_poll(struct file *, poll_table *);
 
 static struct file_operations fops = {
+    .owner = THIS_MODULE,
     .open = device_open,
     .release = device_release,
     .read = device_read,
     .write = device_write,
+    .poll = device_poll,
+    .unlocked_ioctl = device_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
 };
 
-// Hàm bật/tắt LED
-static void led_set(int gpio, int state) {
-    int val = ioread32(gpio_base + GPIO_DATAOUT);
-    if (state)
-        val |= (1 << gpio);
-    else
-        val &= ~(1 << gpio);
-    iowrite32(val, gpio_base + GPIO_DATAOUT);
+// Chân GPIO1 của từng bit trong state word (LED1 = lệnh "1:x", LED2 = lệnh "2:x")
+static const int led_gpio[] = { GPIO_LED_TEMP, GPIO_LED_WEB };
+
+// Đổi mask LED sang mask chân GPIO1
+static u32 led_to_pins(u32 leds) {
+    u32 pins = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(led_gpio); i++)
+        if (leds & LED_BIT(i + 1))
+            pins |= 1 << led_gpio[i];
+    return pins;
+}
+
+// State word đọc lại từ DATAOUT
+static u32 led_state(void) {
+    u32 val = gpio1_read_out();
+    u32 state = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(led_gpio); i++)
+        if (val & (1 << led_gpio[i]))
+            state |= LED_BIT(i + 1);
+    return state;
+}
+
+// Đặt nhiều LED một lần qua gpio1_core (SETDATAOUT/CLEARDATAOUT): không
+// read-modify-write nên không đè lên chân của driver khác cùng bank GPIO1
+static void led_apply(u32 mask, u32 value) {
+    u32 before;
+    bool changed;
+
+    mutex_lock(&led_lock);
+    before = led_state();
+    gpio1_write(led_to_pins(mask), led_to_pins(mask & value));
+    changed = led_state() != before;
+    if (changed) {
+        led_generation++;
+        led_changed_ns = ktime_get_real_ns();
+    }
+    mutex_unlock(&led_lock);
+
+    if (changed)
+        wake_up_interruptible(&led_wq);
+}
+
+// Lấy state word cùng generation của nó
+static u32 led_snapshot(u32 *gen) {
+    u32 state;
+
+    mutex_lock(&led_lock);
+    state = led_state();
+    *gen = led_generation;
+    mutex_unlock(&led_lock);
+    return state;
 }
 
-// Hàm đọc trạng thái LED
-static int led_get(int gpio) {
-    int val = ioread32(gpio_base + GPIO_DATAOUT);
-    return (val & (1 << gpio)) ? 1 : 0;
+// Cho driver_sensorhub.c: state word, generation và thời điểm đổi gần nhất
+u32 led_hub_state(u32 *generation, u64 *changed_ns) {
+    u32 state;
+
+    mutex_lock(&led_lock);
+    state = led_state();
+    *generation = led_generation;
+    *changed_ns = led_changed_ns;
+    mutex_unlock(&led_lock);
+    return state;
+}
+EXPORT_SYMBOL_GPL(led_hub_state);
+
+// Hàm bật/tắt LED
+static void led_set(int led, int state) {
+    led_apply(LED_BIT(led), state ? LED_BIT(led) : 0);
 }
 
+
 static int __init led_init(void) {
-    int val;
+    int ret;
 
     printk(KERN_INFO "LED driver init\n");
 
+    // Giữ 2 chân LED trong gpio1_core trước khi tạo /dev/led
+    ret = gpio1_claim(LED_PINS, DEVICE_NAME);
+    if (ret) return ret;
+
     major_number = register_chrdev(0, DEVICE_NAME, &fops);
-    if (major_number < 0) return major_number;
+    if (major_number < 0) {
+        gpio1_release(LED_PINS);
+        return major_number;
+    }
 
     led_class = class_create(CLASS_NAME);
     if (IS_ERR(led_class)) {
         unregister_chrdev(major_number, DEVICE_NAME);
+        gpio1_release(LED_PINS);
         return PTR_ERR(led_class);
     }
 
@@ -70,68 +156,82 @@ static int __init led_init(void) {
     if (IS_ERR(led_device)) {
         class_destroy(led_class);
         unregister_chrdev(major_number, DEVICE_NAME);
+        gpio1_release(LED_PINS);
         return PTR_ERR(led_device);
     }
 
-    gpio_base = ioremap(GPIO1_BASE, GPIO_SIZE);
-    if (!gpio_base) {
-        device_destroy(led_class, MKDEV(major_number, 0));
-        class_destroy(led_class);
-        unregister_chrdev(major_number, DEVICE_NAME);
-        return -ENOMEM;
-    }
-
-    val = ioread32(gpio_base + GPIO_OE);
-    val &= ~((1 << GPIO_LED_WEB) | (1 << GPIO_LED_TEMP)); // set output
-    iowrite32(val, gpio_base + GPIO_OE);
-
-    led_set(GPIO_LED_WEB, 0);
-    led_set(GPIO_LED_TEMP, 0);
+    gpio1_output(LED_PINS);
+    led_apply(LED_ALL, 0);
 
     printk(KERN_INFO "LED driver loaded successfully\n");
     return 0;
 }
 
 static void __exit led_exit(void) {
-    led_set(GPIO_LED_WEB, 0);
-    led_set(GPIO_LED_TEMP, 0);
-
-    if (gpio_base)
-        iounmap(gpio_base);
+    led_apply(LED_ALL, 0);
 
     device_destroy(led_class, MKDEV(major_number, 0));
     class_destroy(led_class);
     unregister_chrdev(major_number, DEVICE_NAME);
+    gpio1_release(LED_PINS);
 
     printk(KERN_INFO "LED driver unloaded\n");
 }
 
 static int device_open(struct inode *inodep, struct file *filep) {
+    struct led_file *lf = kzalloc(sizeof(*lf), GFP_KERNEL);
+
+    if (!lf)
+        return -ENOMEM;
+    filep->private_data = lf;
     return 0;
 }
 
 static int device_release(struct inode *inodep, struct file *filep) {
+    kfree(filep->private_data);
     return 0;
 }
 
-// Đọc trạng thái 2 LED
+static bool led_has_news(struct led_file *lf) {
+    return READ_ONCE(led_generation) != lf->seen_gen;
+}
+
+// Đọc trạng thái 2 LED: lần đọc đầu trả về ngay, các lần sau chờ tới khi trạng thái đổi
 static ssize_t device_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset) {
+    struct led_file *lf = filep->private_data;
     char status[32];
-    int len_out;
-
-    if (*offset > 0)
-        return 0;
+    u32 state, gen;
+    int len_out, ret;
+
+    if (!led_has_news(lf)) {
+        if (filep->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(led_wq, led_has_news(lf));
+        if (ret)
+            return ret;
+    }
 
+    state = led_snapshot(&gen);
     len_out = snprintf(status, sizeof(status), "1:%d 2:%d\n",
-                       led_get(GPIO_LED_WEB), led_get(GPIO_LED_TEMP));
+                       !!(state & LED1), !!(state & LED2));
+    if (len_out > len)
+        return -EINVAL;
 
     if (copy_to_user(buffer, status, len_out))
         return -EFAULT;
 
+    lf->seen_gen = gen;
     *offset += len_out;
     return len_out;
 }
 
+static __poll_t device_poll(struct file *filep, poll_table *wait) {
+    struct led_file *lf = filep->private_data;
+
+    poll_wait(filep, &led_wq, wait);
+    return led_has_news(lf) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
 // Ghi
 static ssize_t device_write(struct file *filep, const char __user *buffer, size_t len, loff_t *offset) {
     char cmd[16];
@@ -147,8 +247,7 @@ static ssize_t device_write(struct file *filep, const char __user *buffer, size_
 
     if (sscanf(cmd, "%d:%d", &pin, &state) == 2) {
         if ((pin == 1 || pin == 2) && (state == 0 || state == 1)) {
-            int gpio = (pin == 2) ? GPIO_LED_WEB : GPIO_LED_TEMP;
-            led_set(gpio, state);
+            led_set(pin, state);
             return len;
         }
     }
@@ -157,6 +256,33 @@ static ssize_t device_write(struct file *filep, const char __user *buffer, size_
     return -EINVAL;
 }
 
+// Ioctl nhị phân: đặt nhiều LED trong một lần gọi, đọc lại cả state word
+static long device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg) {
+    struct led_file *lf = filep->private_data;
+    struct led_batch batch;
+    struct led_event ev;
+
+    switch (cmd) {
+    case LED_IOC_SET:
+        if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+            return -EFAULT;
+        if (batch.mask & ~LED_ALL)
+            return -EINVAL;
+        led_apply(batch.mask, batch.value);
+        return 0;
+    case LED_IOC_GET_STATE:
+        return put_user(led_state(), (u32 __user *)arg);
+    case LED_IOC_GET_EVENT:
+        ev.state = led_snapshot(&ev.generation);
+        if (copy_to_user((void __user *)arg, &ev, sizeof(ev)))
+            return -EFAULT;
+        lf->seen_gen = ev.generation;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
 module_init(led_init);
 module_exit(led_exit);
 
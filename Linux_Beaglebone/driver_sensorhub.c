@@ -0,0 +1,147 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/uaccess.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/timekeeping.h>
+
+#include "include/sensorhub.h"
+#include "sensorhub_sources.h"
+
+/*
+ * /dev/sensorhub: one binary snapshot of every sensor and the LEDs, built
+ * from the bh1750, dht11 and led drivers (which must be loaded first).
+ * read() returns the cached values; SENSORHUB_IOC_ACQUIRE triggers both
+ * sensors at once so the two samples in the snapshot are taken together.
+ */
+
+#define DEVICE_NAME "sensorhub"
+#define CLASS_NAME  "sensorhub_class"
+#define DEFAULT_ACQUIRE_TIMEOUT_MS 1500  /* DHT11 minimum interval + transfer */
+
+static int major;
+static struct class *hub_class = NULL;
+static struct device *hub_device = NULL;
+static atomic_t hub_seq = ATOMIC_INIT(0);
+
+static unsigned int acquire_timeout_ms = DEFAULT_ACQUIRE_TIMEOUT_MS;
+module_param(acquire_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(acquire_timeout_ms, "Longest wait for the sensors in SENSORHUB_IOC_ACQUIRE");
+
+static void sensorhub_fill(struct sensorhub_snapshot *snap)
+{
+    dht11_hub_latest(&snap->dht11);
+    snap->bh1750_error = bh1750_hub_latest(&snap->bh1750);
+    snap->led_state = led_hub_state(&snap->led_generation, &snap->led_timestamp_ns);
+    snap->timestamp_ns = ktime_get_real_ns();
+    snap->seq = atomic_inc_return(&hub_seq);
+}
+
+/* Trigger both sensors before waiting on either, so the transfers overlap */
+static int sensorhub_acquire(struct sensorhub_snapshot *snap)
+{
+    unsigned long deadline = jiffies + msecs_to_jiffies(acquire_timeout_ms);
+    u32 dht_ticket, bh_ticket;
+    int dht_ret, bh_ret;
+
+    memset(snap, 0, sizeof(*snap));
+    dht_ticket = dht11_hub_trigger();
+    bh_ticket = bh1750_hub_trigger();
+
+    bh_ret = bh1750_hub_wait(bh_ticket, max_t(long, deadline - jiffies, 1));
+    if (bh_ret == -ERESTARTSYS)
+        return bh_ret;
+    dht_ret = dht11_hub_wait(dht_ticket, max_t(long, deadline - jiffies, 1));
+    if (dht_ret == -ERESTARTSYS)
+        return dht_ret;
+
+    sensorhub_fill(snap);
+    if (!dht_ret)
+        snap->flags |= SENSORHUB_DHT11_FRESH;
+    else if (dht_ret == -ETIMEDOUT)
+        snap->dht11.error = dht_ret;
+    if (!bh_ret)
+        snap->flags |= SENSORHUB_BH1750_FRESH;
+    else if (bh_ret == -ETIMEDOUT)
+        snap->bh1750_error = bh_ret;
+    return 0;
+}
+
+static ssize_t sensorhub_read(struct file *file, char __user *buf, size_t count, loff_t *offset)
+{
+    struct sensorhub_snapshot snap;
+
+    if (count < sizeof(snap))
+        return -EINVAL;
+    memset(&snap, 0, sizeof(snap));
+    sensorhub_fill(&snap);
+    if (copy_to_user(buf, &snap, sizeof(snap)))
+        return -EFAULT;
+    *offset += sizeof(snap);
+    return sizeof(snap);
+}
+
+static long sensorhub_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct sensorhub_snapshot snap;
+    int ret;
+
+    switch (cmd) {
+    case SENSORHUB_IOC_ACQUIRE:
+        ret = sensorhub_acquire(&snap);
+        if (ret)
+            return ret;
+        if (copy_to_user((void __user *)arg, &snap, sizeof(snap)))
+            return -EFAULT;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations sensorhub_fops = {
+    .owner = THIS_MODULE,
+    .read = sensorhub_read,
+    .unlocked_ioctl = sensorhub_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+static int __init sensorhub_init(void)
+{
+    major = register_chrdev(0, DEVICE_NAME, &sensorhub_fops);
+    if (major < 0) {
+        pr_err("SENSORHUB: Failed to register major number\n");
+        return major;
+    }
+
+    hub_class = class_create(CLASS_NAME);
+    if (IS_ERR(hub_class)) {
+        unregister_chrdev(major, DEVICE_NAME);
+        return PTR_ERR(hub_class);
+    }
+
+    hub_device = device_create(hub_class, NULL, MKDEV(major, 0), NULL, DEVICE_NAME);
+    if (IS_ERR(hub_device)) {
+        class_destroy(hub_class);
+        unregister_chrdev(major, DEVICE_NAME);
+        return PTR_ERR(hub_device);
+    }
+
+    pr_info("SENSORHUB: Module loaded, major=%d\n", major);
+    return 0;
+}
+
+static void __exit sensorhub_exit(void)
+{
+    device_destroy(hub_class, MKDEV(major, 0));
+    class_destroy(hub_class);
+    unregister_chrdev(major, DEVICE_NAME);
+    pr_info("SENSORHUB: Module unloaded\n");
+}
+module_init(sensorhub_init);
+module_exit(sensorhub_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Toan");
+MODULE_DESCRIPTION("Combined sensor and LED snapshot device");
@@ -0,0 +1,917 @@
+#include <linux/module.h>
+#include <linux/io.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "gpio1_core.h"
+
+/*
+ * Register access for the GPIO1 bank, shared by the sensor and LED
+ * drivers. Levels go through the atomic SET/CLEARDATAOUT registers so they
+ * need no lock. Direction changes compare against a shadow of OE for the
+ * claimed pins, so a driver toggling a line between input and output every
+ * few microseconds only writes OE on real changes. On the am335x and sim
+ * backends that compare-and-write runs under oe_lock, a raw spinlock, so a
+ * bit-banged clock phase is never stretched by sleeping on a busy lock.
+ *
+ * OE is still read-modify-written because pins nobody claimed here (the
+ * board's USR LEDs, pins driven through gpiolib) share the register. If a
+ * claimed pin's OE bit is found different from the shadow, something
+ * outside this module changed it; that is counted as foreign_oe.
+ *
+ * The registers themselves sit behind a backend, chosen at load time:
+ *
+ *   backend=am335x   the real bank at 0x4804C000 (default)
+ *   backend=gpio-sim 32 lines of an upstream gpio-sim bank, starting at
+ *                    legacy GPIO number gpiosim_base; levels can be watched
+ *                    and pulled from user space, but nothing answers like
+ *                    a sensor would
+ *   backend=sim      an in-kernel bank with a DHT11 and a BH1750 wired to
+ *                    it; both answer with the datasheet waveforms
+ *
+ * With gpio-sim or sim the three drivers load on any kernel (x86, QEMU)
+ * and the bit-bang and polling decoders can be exercised and benchmarked
+ * without a BeagleBone. gpio-sim sleeps inside its callbacks, which is why
+ * claims take gpio1_lock, a mutex, callers must be able to sleep, and
+ * gpio-sim direction changes take gpio1_lock instead of oe_lock.
+ *
+ * Debug counters: /sys/kernel/debug/gpio1_core/stats
+ */
+
+#define GPIO1_BASE   0x4804C000
+#define GPIO_SIZE    0x1000
+#define GPIO_OE           0x134
+#define GPIO_DATAIN       0x138
+#define GPIO_DATAOUT      0x13C
+#define GPIO_CLEARDATAOUT 0x190
+#define GPIO_SETDATAOUT   0x194
+
+struct gpio1_backend {
+    const char *name;
+    int (*init)(void);
+    void (*exit)(void);
+    int (*claim)(u32 mask, const char *owner);  /* Optional, gpio1_lock held */
+    void (*release)(u32 mask);                  /* Optional, gpio1_lock held */
+    u32 (*read_oe)(void);                       /* gpio1_lock held */
+    void (*write_oe)(u32 oe);                   /* oe_lock (gpio1_lock if can_sleep) held,
+                                                   oe_shadow still old */
+    void (*set)(u32 mask);
+    void (*clear)(u32 mask);
+    u32 (*read_in)(void);
+    u32 (*read_out)(void);
+    int (*to_irq)(unsigned int bit);            /* Optional */
+    bool can_sleep;                             /* write_oe sleeps: gpio1_lock, not oe_lock */
+};
+
+static char *backend = "am335x";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "Register backend: am335x, gpio-sim or sim");
+
+static const struct gpio1_backend *be;
+static DEFINE_MUTEX(gpio1_lock);      /* Protects the claims */
+static DEFINE_RAW_SPINLOCK(oe_lock);  /* OE shadow and OE writes, unless be->can_sleep */
+static u32 claimed;                   /* Written under both locks */
+static const char *owners[32];
+static u32 oe_shadow;                 /* OE of the claimed pins, 1 = input */
+
+static struct {
+    atomic64_t contended;        /* gpio1_lock or oe_lock was busy */
+    atomic64_t claim_conflicts;  /* gpio1_claim() on a pin already taken */
+    atomic64_t oe_writes;
+    atomic64_t oe_skipped;       /* Direction requests that changed nothing */
+    atomic64_t foreign_oe;       /* Claimed OE bits changed outside this module */
+    atomic64_t unclaimed;        /* Accesses to pins the caller did not claim */
+} stats;
+static struct dentry *debug_dir;
+
+#define gpio1_lock_acquire()                                 \
+    do {                                                     \
+        if (!mutex_trylock(&gpio1_lock)) {                   \
+            atomic64_inc(&stats.contended);                  \
+            mutex_lock(&gpio1_lock);                         \
+        }                                                    \
+    } while (0)
+
+/* ------------------------------------------------------------------------
+ * am335x: the real bank
+ */
+static void __iomem *gpio_base;
+static u32 am335x_irq_pins;           /* Pins requested from gpiolib for an IRQ */
+
+static int am335x_init(void)
+{
+    gpio_base = ioremap(GPIO1_BASE, GPIO_SIZE);
+    if (!gpio_base) {
+        pr_err("GPIO1: Failed to ioremap GPIO1\n");
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void am335x_exit(void)
+{
+    iounmap(gpio_base);
+}
+
+static void am335x_release(u32 mask)
+{
+    unsigned long bits = mask & am335x_irq_pins;
+    unsigned int bit;
+
+    for_each_set_bit(bit, &bits, 32)
+        gpio_free(GPIO1_FIRST + bit);
+    am335x_irq_pins &= ~mask;
+}
+
+static u32 am335x_read_oe(void)
+{
+    return ioread32(gpio_base + GPIO_OE);
+}
+
+static void am335x_write_oe(u32 oe)
+{
+    u32 reg = ioread32(gpio_base + GPIO_OE);
+
+    if ((reg ^ oe_shadow) & claimed)
+        atomic64_inc(&stats.foreign_oe);
+    iowrite32((reg & ~claimed) | (oe & claimed), gpio_base + GPIO_OE);
+}
+
+static void am335x_set(u32 mask)
+{
+    iowrite32(mask, gpio_base + GPIO_SETDATAOUT);
+}
+
+static void am335x_clear(u32 mask)
+{
+    iowrite32(mask, gpio_base + GPIO_CLEARDATAOUT);
+}
+
+static u32 am335x_read_in(void)
+{
+    return ioread32(gpio_base + GPIO_DATAIN);
+}
+
+static u32 am335x_read_out(void)
+{
+    return ioread32(gpio_base + GPIO_DATAOUT);
+}
+
+/* The omap gpiolib driver owns the interrupt side, borrow the line from it */
+static int am335x_to_irq(unsigned int bit)
+{
+    int ret;
+
+    mutex_lock(&gpio1_lock);
+    if (!(am335x_irq_pins & BIT(bit))) {
+        ret = gpio_request(GPIO1_FIRST + bit, owners[bit]);
+        if (ret) {
+            mutex_unlock(&gpio1_lock);
+            return ret;
+        }
+        am335x_irq_pins |= BIT(bit);
+    }
+    mutex_unlock(&gpio1_lock);
+    return gpio_to_irq(GPIO1_FIRST + bit);
+}
+
+static const struct gpio1_backend am335x_backend = {
+    .name = "am335x",
+    .init = am335x_init,
+    .exit = am335x_exit,
+    .release = am335x_release,
+    .read_oe = am335x_read_oe,
+    .write_oe = am335x_write_oe,
+    .set = am335x_set,
+    .clear = am335x_clear,
+    .read_in = am335x_read_in,
+    .read_out = am335x_read_out,
+    .to_irq = am335x_to_irq,
+};
+
+/* ------------------------------------------------------------------------
+ * gpio-sim: GPIO1_n is line n of a gpio-sim bank created through configfs
+ * with at least 32 lines, e.g.
+ *
+ *   mkdir /sys/kernel/config/gpio-sim/bbb /sys/kernel/config/gpio-sim/bbb/bank0
+ *   echo 32 > /sys/kernel/config/gpio-sim/bbb/bank0/num_lines
+ *   echo 1 > /sys/kernel/config/gpio-sim/bbb/live
+ *
+ * and gpiosim_base set to the base that bank got in /sys/kernel/debug/gpio.
+ * Levels of input lines follow the pulls set under
+ * /sys/devices/platform/gpio-sim.N/gpiochipM/sim_gpioX/pull.
+ */
+static int gpiosim_base = -1;
+module_param(gpiosim_base, int, 0444);
+MODULE_PARM_DESC(gpiosim_base, "Legacy GPIO number of line 0 of the gpio-sim bank (backend=gpio-sim)");
+
+static struct gpio_desc *gs_desc[32];
+static atomic_t gs_out;               /* DATAOUT: gpio-sim has no level for inputs */
+
+static int gpiosim_init(void)
+{
+    if (gpiosim_base < 0 || !gpio_to_desc(gpiosim_base) || !gpio_to_desc(gpiosim_base + 31)) {
+        pr_err("GPIO1: gpiosim_base must name a gpio-sim bank with 32 lines\n");
+        return -ENODEV;
+    }
+    return 0;
+}
+
+static void gpiosim_release(u32 mask)
+{
+    unsigned long bits = mask;
+    unsigned int bit;
+
+    for_each_set_bit(bit, &bits, 32) {
+        if (!gs_desc[bit])
+            continue;
+        gpio_free(gpiosim_base + bit);
+        gs_desc[bit] = NULL;
+    }
+}
+
+static int gpiosim_claim(u32 mask, const char *owner)
+{
+    unsigned long bits = mask;
+    unsigned int bit;
+    int ret;
+
+    for_each_set_bit(bit, &bits, 32) {
+        ret = gpio_request(gpiosim_base + bit, owner);
+        if (ret) {
+            gpiosim_release(mask);
+            return ret;
+        }
+        gs_desc[bit] = gpio_to_desc(gpiosim_base + bit);
+    }
+    return 0;
+}
+
+static u32 gpiosim_read_oe(void)
+{
+    unsigned long bits = claimed;
+    unsigned int bit;
+    u32 oe = ~claimed;
+
+    for_each_set_bit(bit, &bits, 32)
+        if (gpiod_get_direction(gs_desc[bit]) != 0)
+            oe |= BIT(bit);
+    return oe;
+}
+
+static void gpiosim_write_oe(u32 oe)
+{
+    unsigned long bits = (oe ^ oe_shadow) & claimed;
+    u32 out = atomic_read(&gs_out);
+    unsigned int bit;
+
+    for_each_set_bit(bit, &bits, 32) {
+        if (oe & BIT(bit))
+            gpiod_direction_input(gs_desc[bit]);
+        else
+            gpiod_direction_output_raw(gs_desc[bit], !!(out & BIT(bit)));
+    }
+}
+
+/* Only pins currently driven change, inputs pick the level up on output */
+static void gpiosim_apply(u32 mask, int value)
+{
+    unsigned long bits = mask & ~READ_ONCE(oe_shadow);
+    unsigned int bit;
+
+    for_each_set_bit(bit, &bits, 32)
+        gpiod_set_raw_value_cansleep(gs_desc[bit], value);
+}
+
+static void gpiosim_set(u32 mask)
+{
+    atomic_or(mask, &gs_out);
+    gpiosim_apply(mask, 1);
+}
+
+static void gpiosim_clear(u32 mask)
+{
+    atomic_andnot(mask, &gs_out);
+    gpiosim_apply(mask, 0);
+}
+
+static u32 gpiosim_read_in(void)
+{
+    unsigned long bits = READ_ONCE(claimed);
+    unsigned int bit;
+    u32 in = 0;
+
+    for_each_set_bit(bit, &bits, 32)
+        if (gpiod_get_raw_value_cansleep(gs_desc[bit]) > 0)
+            in |= BIT(bit);
+    return in;
+}
+
+static u32 gpiosim_read_out(void)
+{
+    return atomic_read(&gs_out);
+}
+
+static int gpiosim_to_irq(unsigned int bit)
+{
+    return gpiod_to_irq(gs_desc[bit]);
+}
+
+static const struct gpio1_backend gpiosim_backend = {
+    .name = "gpio-sim",
+    .init = gpiosim_init,
+    .claim = gpiosim_claim,
+    .release = gpiosim_release,
+    .read_oe = gpiosim_read_oe,
+    .write_oe = gpiosim_write_oe,
+    .set = gpiosim_set,
+    .clear = gpiosim_clear,
+    .read_in = gpiosim_read_in,
+    .read_out = gpiosim_read_out,
+    .to_irq = gpiosim_to_irq,
+    .can_sleep = true,
+};
+
+/* ------------------------------------------------------------------------
+ * sim: an in-kernel bank with the two sensors attached. Every pin has a
+ * pull-up; a pin reads low when it is driven low, or when it is an input
+ * and a simulated sensor pulls it low.
+ *
+ * The DHT11 answers a host start pulse of at least 18 ms with the
+ * datasheet waveform, computed from the time elapsed since the host let
+ * go of the line: 80 us low, 80 us high, then per bit 50 us low and 27 or
+ * 70 us high. The BH1750 is an I2C slave at 0x23 stepped on every SCL/SDA
+ * edge. It ACKs its address, takes the measurement/MTreg commands and
+ * returns sim_lux scaled the way the real chip scales it. There is no
+ * conversion delay; the driver's own waits still apply. No interrupts are
+ * simulated, so the DHT11 driver falls back to its polling decoder.
+ */
+#define SIM_BH1750_ADDR     0x23
+#define SIM_DHT11_START_US  18000
+#define SIM_DHT11_WAIT_US   25   /* Host release to sensor response */
+
+static int sim_dht11_pin = 13;
+module_param(sim_dht11_pin, int, 0444);
+MODULE_PARM_DESC(sim_dht11_pin, "GPIO1 pin of the simulated DHT11 (backend=sim)");
+static int sim_scl_pin = 17;
+module_param(sim_scl_pin, int, 0444);
+MODULE_PARM_DESC(sim_scl_pin, "GPIO1 pin of the simulated BH1750 SCL (backend=sim)");
+static int sim_sda_pin = 16;
+module_param(sim_sda_pin, int, 0444);
+MODULE_PARM_DESC(sim_sda_pin, "GPIO1 pin of the simulated BH1750 SDA (backend=sim)");
+static int sim_temp = 27;
+module_param(sim_temp, int, 0644);
+MODULE_PARM_DESC(sim_temp, "Temperature reported by the simulated DHT11 (C)");
+static int sim_hum = 55;
+module_param(sim_hum, int, 0644);
+MODULE_PARM_DESC(sim_hum, "Humidity reported by the simulated DHT11 (%)");
+static int sim_lux = 300;
+module_param(sim_lux, int, 0644);
+MODULE_PARM_DESC(sim_lux, "Illuminance seen by the simulated BH1750 (lx)");
+
+enum sim_i2c_state { SIM_I2C_IDLE, SIM_I2C_RX, SIM_I2C_ACK_OUT, SIM_I2C_TX, SIM_I2C_ACK_IN };
+
+static DEFINE_RAW_SPINLOCK(sim_lock);     /* Protects everything below */
+static u32 sim_oe = ~0U;              /* Reset state: all inputs */
+static u32 sim_out;
+static u32 sim_lines = ~0U;           /* Levels the models last saw */
+static u32 dht_pin, scl_pin, sda_pin;
+
+static struct {
+    ktime_t low_since;                /* Host started driving the line low */
+    ktime_t frame_start;              /* Host released after a valid start */
+    u8 frame[5];
+} sim_dht;
+
+static struct {
+    enum sim_i2c_state state;
+    bool addressed, read, sda_low, master_ack;
+    u8 shift, bit, mode, mtreg;
+    u8 tx[2];
+    unsigned int tx_idx;
+} sim_bh = { .mode = 0x20, .mtreg = 69 };
+
+static struct {
+    u64 dht_frames;
+    u64 dht_short_starts;             /* Start pulses under 18 ms */
+    u64 bh_xfers;
+    u64 bh_nacks;                     /* Addresses we did not answer */
+} sim_stats;
+
+static int sim_init(void)
+{
+    if (sim_dht11_pin < 0 || sim_dht11_pin > 31 || sim_scl_pin < 0 || sim_scl_pin > 31 ||
+        sim_sda_pin < 0 || sim_sda_pin > 31)
+        return -EINVAL;
+    dht_pin = BIT(sim_dht11_pin);
+    scl_pin = BIT(sim_scl_pin);
+    sda_pin = BIT(sim_sda_pin);
+    return 0;
+}
+
+/* Length of bit n of the DHT11 frame in its high phase */
+static unsigned int sim_dht_high_us(unsigned int n)
+{
+    return (sim_dht.frame[n / 8] & BIT(7 - n % 8)) ? 70 : 27;
+}
+
+/* Is the simulated DHT11 pulling its line low at `now`? */
+static bool sim_dht_low(ktime_t now)
+{
+    s64 t;
+    unsigned int n;
+
+    if (!sim_dht.frame_start)
+        return false;
+    t = ktime_us_delta(now, sim_dht.frame_start) - SIM_DHT11_WAIT_US;
+    if (t < 0)
+        return false;
+    if (t < 80)
+        return true;
+    t -= 160;
+    if (t < 0)
+        return false;
+    for (n = 0; n < 40; n++) {
+        if (t < 50)
+            return true;
+        t -= 50 + sim_dht_high_us(n);
+        if (t < 0)
+            return false;
+    }
+    if (t < 50)
+        return true;
+    sim_dht.frame_start = 0;          /* Frame done, line back to the pull-up */
+    return false;
+}
+
+static u32 sim_levels(ktime_t now)
+{
+    u32 lines = (sim_out & ~sim_oe) | sim_oe;
+
+    if (sim_bh.sda_low)
+        lines &= ~sda_pin;
+    if ((sim_oe & dht_pin) && sim_dht_low(now))
+        lines &= ~dht_pin;
+    return lines;
+}
+
+static void sim_dht_step(ktime_t now)
+{
+    bool host_low = !(sim_oe & dht_pin) && !(sim_out & dht_pin);
+    int temp = clamp(sim_temp, 0, 50), hum = clamp(sim_hum, 20, 90);
+
+    if (host_low && !sim_dht.low_since) {
+        sim_dht.low_since = now;
+        sim_dht.frame_start = 0;
+    } else if (!host_low && sim_dht.low_since) {
+        if (ktime_us_delta(now, sim_dht.low_since) >= SIM_DHT11_START_US) {
+            sim_dht.frame[0] = hum;
+            sim_dht.frame[1] = 0;
+            sim_dht.frame[2] = temp;
+            sim_dht.frame[3] = 0;
+            sim_dht.frame[4] = hum + temp;
+            sim_dht.frame_start = now;
+            sim_stats.dht_frames++;
+        } else {
+            sim_stats.dht_short_starts++;
+        }
+        sim_dht.low_since = 0;
+    }
+}
+
+/* Raw count the way the chip reports it: lux * 1.2 * MTreg / 69, doubled in H2 */
+static u16 sim_bh_raw(void)
+{
+    u64 raw = (u64)max(sim_lux, 0) * 12 * sim_bh.mtreg / (10 * 69);
+
+    if ((sim_bh.mode & 0x03) == 0x01)
+        raw *= 2;
+    else if ((sim_bh.mode & 0x03) == 0x03)
+        raw &= ~3ULL;                 /* L-resolution: 4 lx steps */
+    return min_t(u64, raw, 0xFFFF);
+}
+
+static void sim_bh_command(u8 cmd)
+{
+    if ((cmd & 0xF8) == 0x40)
+        sim_bh.mtreg = (sim_bh.mtreg & 0x1F) | ((cmd & 0x07) << 5);
+    else if ((cmd & 0xE0) == 0x60)
+        sim_bh.mtreg = (sim_bh.mtreg & 0xE0) | (cmd & 0x1F);
+    else if (((cmd & 0xFC) == 0x10 || (cmd & 0xFC) == 0x20) && (cmd & 0x03) != 0x02)
+        sim_bh.mode = cmd;            /* Continuous/one-time H, H2 or L; 0x12/0x22 reserved */
+    /* Power down/on and reset change nothing the model reports */
+}
+
+static void sim_bh_load(void)
+{
+    sim_bh.bit = 0;
+    sim_bh.sda_low = !(sim_bh.tx[sim_bh.tx_idx & 1] & 0x80);
+}
+
+static void sim_bh_scl_rise(bool sda)
+{
+    switch (sim_bh.state) {
+    case SIM_I2C_RX:
+        sim_bh.shift = (sim_bh.shift << 1) | sda;
+        sim_bh.bit++;
+        break;
+    case SIM_I2C_ACK_IN:
+        sim_bh.master_ack = !sda;
+        break;
+    default:
+        break;
+    }
+}
+
+static void sim_bh_scl_fall(void)
+{
+    u16 raw;
+
+    switch (sim_bh.state) {
+    case SIM_I2C_RX:
+        if (sim_bh.bit < 8)
+            break;
+        if (!sim_bh.addressed) {
+            if ((sim_bh.shift >> 1) != SIM_BH1750_ADDR) {
+                sim_stats.bh_nacks++;
+                sim_bh.state = SIM_I2C_IDLE;
+                break;
+            }
+            sim_bh.addressed = true;
+            sim_bh.read = sim_bh.shift & 1;
+            sim_stats.bh_xfers++;
+        } else {
+            sim_bh_command(sim_bh.shift);
+        }
+        sim_bh.sda_low = true;        /* ACK */
+        sim_bh.state = SIM_I2C_ACK_OUT;
+        break;
+    case SIM_I2C_ACK_OUT:
+        sim_bh.sda_low = false;
+        if (sim_bh.read) {
+            raw = sim_bh_raw();
+            sim_bh.tx[0] = raw >> 8;
+            sim_bh.tx[1] = raw & 0xFF;
+            sim_bh.tx_idx = 0;
+            sim_bh_load();
+            sim_bh.state = SIM_I2C_TX;
+        } else {
+            sim_bh.shift = 0;
+            sim_bh.bit = 0;
+            sim_bh.state = SIM_I2C_RX;
+        }
+        break;
+    case SIM_I2C_TX:
+        if (++sim_bh.bit < 8) {
+            sim_bh.sda_low = !(sim_bh.tx[sim_bh.tx_idx & 1] & (0x80 >> sim_bh.bit));
+        } else {
+            sim_bh.sda_low = false;
+            sim_bh.state = SIM_I2C_ACK_IN;
+        }
+        break;
+    case SIM_I2C_ACK_IN:
+        if (sim_bh.master_ack) {
+            sim_bh.tx_idx++;
+            sim_bh_load();
+            sim_bh.state = SIM_I2C_TX;
+        } else {
+            sim_bh.state = SIM_I2C_IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Feed the line changes since the last call to the models, under sim_lock */
+static void sim_step(void)
+{
+    ktime_t now = ktime_get();
+    u32 lines, changed;
+
+    sim_dht_step(now);
+    lines = sim_levels(now);
+    changed = lines ^ sim_lines;
+
+    /* SDA moving while SCL is high is START or STOP, otherwise data */
+    if ((changed & sda_pin) && (sim_lines & scl_pin)) {
+        if (!(lines & sda_pin)) {
+            sim_bh.state = SIM_I2C_RX;
+            sim_bh.addressed = false;
+            sim_bh.shift = 0;
+            sim_bh.bit = 0;
+        } else {
+            sim_bh.state = SIM_I2C_IDLE;
+        }
+        sim_bh.sda_low = false;
+    }
+    if (changed & scl_pin) {
+        if (lines & scl_pin)
+            sim_bh_scl_rise(!!(lines & sda_pin));
+        else
+            sim_bh_scl_fall();
+    }
+    sim_lines = sim_levels(now);
+}
+
+static u32 sim_read_oe(void)
+{
+    return READ_ONCE(sim_oe);
+}
+
+static void sim_write_oe(u32 oe)
+{
+    unsigned long flags;
+
+    raw_spin_lock_irqsave(&sim_lock, flags);
+    sim_oe = (sim_oe & ~claimed) | (oe & claimed);
+    sim_step();
+    raw_spin_unlock_irqrestore(&sim_lock, flags);
+}
+
+static void sim_set(u32 mask)
+{
+    unsigned long flags;
+
+    raw_spin_lock_irqsave(&sim_lock, flags);
+    sim_out |= mask;
+    sim_step();
+    raw_spin_unlock_irqrestore(&sim_lock, flags);
+}
+
+static void sim_clear(u32 mask)
+{
+    unsigned long flags;
+
+    raw_spin_lock_irqsave(&sim_lock, flags);
+    sim_out &= ~mask;
+    sim_step();
+    raw_spin_unlock_irqrestore(&sim_lock, flags);
+}
+
+static u32 sim_read_in(void)
+{
+    unsigned long flags;
+    u32 lines;
+
+    raw_spin_lock_irqsave(&sim_lock, flags);
+    lines = sim_levels(ktime_get());
+    raw_spin_unlock_irqrestore(&sim_lock, flags);
+    return lines;
+}
+
+static u32 sim_read_out(void)
+{
+    return READ_ONCE(sim_out);
+}
+
+static const struct gpio1_backend sim_backend = {
+    .name = "sim",
+    .init = sim_init,
+    .read_oe = sim_read_oe,
+    .write_oe = sim_write_oe,
+    .set = sim_set,
+    .clear = sim_clear,
+    .read_in = sim_read_in,
+    .read_out = sim_read_out,
+};
+
+static const struct gpio1_backend *const backends[] = {
+    &am335x_backend,
+    &gpiosim_backend,
+    &sim_backend,
+};
+
+/* ------------------------------------------------------------------------
+ * API
+ */
+
+/* Catch drivers touching pins they do not own, once in the log and in the stats */
+static bool gpio1_check_claimed(u32 mask)
+{
+    if (likely(!(mask & ~READ_ONCE(claimed))))
+        return true;
+    atomic64_inc(&stats.unclaimed);
+    WARN_ONCE(1, "GPIO1: access to unclaimed pins 0x%08x\n", mask & ~READ_ONCE(claimed));
+    return false;
+}
+
+int gpio1_claim(u32 mask, const char *owner)
+{
+    unsigned long bits = mask;
+    unsigned long flags;
+    unsigned int bit;
+    u32 busy, oe;
+    int ret;
+
+    gpio1_lock_acquire();
+    busy = claimed & mask;
+    if (busy) {
+        mutex_unlock(&gpio1_lock);
+        atomic64_inc(&stats.claim_conflicts);
+        pr_err("GPIO1: %s: pin %u already claimed by %s\n",
+               owner, __ffs(busy), owners[__ffs(busy)]);
+        return -EBUSY;
+    }
+    if (be->claim) {
+        ret = be->claim(mask, owner);
+        if (ret) {
+            mutex_unlock(&gpio1_lock);
+            pr_err("GPIO1: %s: %s backend refused pins 0x%08x (%d)\n", owner, be->name, mask, ret);
+            return ret;
+        }
+    }
+    oe = be->read_oe();
+    raw_spin_lock_irqsave(&oe_lock, flags);
+    claimed |= mask;
+    oe_shadow = (oe_shadow & ~mask) | (oe & mask);
+    raw_spin_unlock_irqrestore(&oe_lock, flags);
+    for_each_set_bit(bit, &bits, 32)
+        owners[bit] = owner;
+    mutex_unlock(&gpio1_lock);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(gpio1_claim);
+
+void gpio1_release(u32 mask)
+{
+    unsigned long bits = mask;
+    unsigned long flags;
+    unsigned int bit;
+
+    gpio1_lock_acquire();
+    if (be->release)
+        be->release(mask & claimed);
+    raw_spin_lock_irqsave(&oe_lock, flags);
+    claimed &= ~mask;
+    raw_spin_unlock_irqrestore(&oe_lock, flags);
+    for_each_set_bit(bit, &bits, 32)
+        owners[bit] = NULL;
+    mutex_unlock(&gpio1_lock);
+}
+EXPORT_SYMBOL_GPL(gpio1_release);
+
+void gpio1_set(u32 mask)
+{
+    if (gpio1_check_claimed(mask))
+        be->set(mask);
+}
+EXPORT_SYMBOL_GPL(gpio1_set);
+
+void gpio1_clear(u32 mask)
+{
+    if (gpio1_check_claimed(mask))
+        be->clear(mask);
+}
+EXPORT_SYMBOL_GPL(gpio1_clear);
+
+void gpio1_write(u32 mask, u32 value)
+{
+    if (!gpio1_check_claimed(mask))
+        return;
+    if (mask & value)
+        be->set(mask & value);
+    if (mask & ~value)
+        be->clear(mask & ~value);
+}
+EXPORT_SYMBOL_GPL(gpio1_write);
+
+/* Compare with the shadow and write OE, called with the direction lock held */
+static bool gpio1_update_oe(u32 output, u32 input)
+{
+    u32 want = (oe_shadow & ~output) | input;
+
+    if (want == oe_shadow)
+        return false;
+    be->write_oe(want);
+    oe_shadow = want;
+    return true;
+}
+
+void gpio1_direction(u32 output, u32 input)
+{
+    unsigned long flags;
+    bool written;
+
+    if (!gpio1_check_claimed(output | input))
+        return;
+
+    if (be->can_sleep) {
+        gpio1_lock_acquire();
+        written = gpio1_update_oe(output, input);
+        mutex_unlock(&gpio1_lock);
+    } else {
+        if (!raw_spin_trylock_irqsave(&oe_lock, flags)) {
+            atomic64_inc(&stats.contended);
+            raw_spin_lock_irqsave(&oe_lock, flags);
+        }
+        written = gpio1_update_oe(output, input);
+        raw_spin_unlock_irqrestore(&oe_lock, flags);
+    }
+    atomic64_inc(written ? &stats.oe_writes : &stats.oe_skipped);
+}
+EXPORT_SYMBOL_GPL(gpio1_direction);
+
+u32 gpio1_read_in(void)
+{
+    return be->read_in();
+}
+EXPORT_SYMBOL_GPL(gpio1_read_in);
+
+u32 gpio1_read_out(void)
+{
+    return be->read_out();
+}
+EXPORT_SYMBOL_GPL(gpio1_read_out);
+
+int gpio1_to_irq(u32 mask)
+{
+    if (!mask || (mask & (mask - 1)) || !gpio1_check_claimed(mask))
+        return -EINVAL;
+    if (!be->to_irq)
+        return -ENXIO;
+    return be->to_irq(__ffs(mask));
+}
+EXPORT_SYMBOL_GPL(gpio1_to_irq);
+
+/* debugfs: gpio1_core/stats */
+static int gpio1_stats_show(struct seq_file *m, void *v)
+{
+    unsigned long flags, bits;
+    const char *names[32];
+    u32 shadow;
+    unsigned int bit;
+
+    gpio1_lock_acquire();
+    raw_spin_lock_irqsave(&oe_lock, flags);
+    bits = claimed;
+    shadow = oe_shadow;
+    raw_spin_unlock_irqrestore(&oe_lock, flags);
+    memcpy(names, owners, sizeof(names));
+    mutex_unlock(&gpio1_lock);
+
+    seq_printf(m, "backend:         %s\n", be->name);
+    for_each_set_bit(bit, &bits, 32)
+        seq_printf(m, "GPIO1_%-2u %-6s %s\n", bit,
+                   (shadow & BIT(bit)) ? "input" : "output", names[bit]);
+    seq_printf(m, "contended:       %lld\n", atomic64_read(&stats.contended));
+    seq_printf(m, "claim_conflicts: %lld\n", atomic64_read(&stats.claim_conflicts));
+    seq_printf(m, "oe_writes:       %lld\n", atomic64_read(&stats.oe_writes));
+    seq_printf(m, "oe_skipped:      %lld\n", atomic64_read(&stats.oe_skipped));
+    seq_printf(m, "foreign_oe:      %lld\n", atomic64_read(&stats.foreign_oe));
+    seq_printf(m, "unclaimed:       %lld\n", atomic64_read(&stats.unclaimed));
+    if (be == &sim_backend) {
+        raw_spin_lock_irqsave(&sim_lock, flags);
+        seq_printf(m, "sim_dht11_frames: %llu\n", sim_stats.dht_frames);
+        seq_printf(m, "sim_dht11_short_starts: %llu\n", sim_stats.dht_short_starts);
+        seq_printf(m, "sim_bh1750_xfers: %llu\n", sim_stats.bh_xfers);
+        seq_printf(m, "sim_bh1750_nacks: %llu\n", sim_stats.bh_nacks);
+        raw_spin_unlock_irqrestore(&sim_lock, flags);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(gpio1_stats);
+
+static int __init gpio1_core_init(void)
+{
+    int i, ret;
+
+    for (i = 0; i < ARRAY_SIZE(backends); i++)
+        if (sysfs_streq(backend, backends[i]->name))
+            be = backends[i];
+    if (!be) {
+        pr_err("GPIO1: unknown backend '%s'\n", backend);
+        return -EINVAL;
+    }
+    if (be->init) {
+        ret = be->init();
+        if (ret)
+            return ret;
+    }
+    debug_dir = debugfs_create_dir("gpio1_core", NULL);
+    debugfs_create_file("stats", 0400, debug_dir, NULL, &gpio1_stats_fops);
+    pr_info("GPIO1: core loaded, %s backend\n", be->name);
+    return 0;
+}
+
+static void __exit gpio1_core_exit(void)
+{
+    debugfs_remove_recursive(debug_dir);
+    WARN(claimed, "GPIO1: unloading with pins 0x%08x still claimed\n", claimed);
+    if (be->exit)
+        be->exit();
+    pr_info("GPIO1: core unloaded\n");
+}
+module_init(gpio1_core_init);
+module_exit(gpio1_core_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Toan");
+MODULE_DESCRIPTION("Shared GPIO1 bank access for the BeagleBone sensor drivers");
@@ -0,0 +1,48 @@
+/*
+ * gpio1_core: single owner of the AM335x GPIO1 register bank.
+ *
+ * driver_bh1750.c, driver_dht11.c and driver_led.c claim their pins here
+ * instead of each ioremap()ing the bank and read-modify-writing OE and
+ * DATAOUT behind each other's back. Pins are given as masks of GPIO1 bit
+ * numbers (GPIO1_13 = BIT(13)); a mask may hold several pins of one owner.
+ *
+ * The bank behind these calls is the real AM335x one, a gpio-sim bank or
+ * a simulated bank with the sensors attached (gpio1_core backend=...). All
+ * calls may sleep.
+ */
+#ifndef _GPIO1_CORE_H
+#define _GPIO1_CORE_H
+
+#include <linux/types.h>
+
+#define GPIO1_FIRST 32  /* Linux GPIO number of GPIO1_0 */
+
+/* Reserve pins for `owner` (a string that outlives the claim), -EBUSY if taken */
+int gpio1_claim(u32 mask, const char *owner);
+void gpio1_release(u32 mask);
+
+/* Output levels through SETDATAOUT/CLEARDATAOUT: other pins are never touched */
+void gpio1_set(u32 mask);
+void gpio1_clear(u32 mask);
+void gpio1_write(u32 mask, u32 value);  /* Pins in mask take their bit of value */
+
+/* Switch pins to output/input; OE is only written when a pin really changes */
+void gpio1_direction(u32 output, u32 input);
+
+static inline void gpio1_output(u32 mask)
+{
+    gpio1_direction(mask, 0);
+}
+
+static inline void gpio1_input(u32 mask)
+{
+    gpio1_direction(0, mask);
+}
+
+u32 gpio1_read_in(void);   /* DATAIN: line levels */
+u32 gpio1_read_out(void);  /* DATAOUT: driven levels */
+
+/* Interrupt of one claimed pin, -ENXIO if the backend has none */
+int gpio1_to_irq(u32 mask);
+
+#endif /* _GPIO1_CORE_H */
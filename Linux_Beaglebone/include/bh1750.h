@@ -0,0 +1,100 @@
+/*
+ * User-space interface of /dev/bh1750, shared by driver_bh1750.c and the
+ * applications (app.c is built with -I include).
+ */
+#ifndef _BH1750_H
+#define _BH1750_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* read() output format, selected per open file with BH1750_IOC_SET_FORMAT */
+#define BH1750_FORMAT_TEXT   0  /* "<lux> <timestamp_ns> <seq>\n", latest sample */
+#define BH1750_FORMAT_BINARY 1  /* Array of struct bh1750_record drained from the ring */
+/* The ring is shared: with several binary readers each record reaches only one */
+
+/* One sample of the driver's ring buffer */
+struct bh1750_record {
+    __u64 timestamp_ns;   /* CLOCK_REALTIME at acquisition */
+    __u32 seq;            /* Acquisition sequence number */
+    __u32 millilux;
+    __u16 raw;            /* Sensor count as read from the bus */
+    __u16 reserved[3];
+};
+
+struct bh1750_fifo_status {
+    __u32 level;          /* Records waiting in the ring */
+    __u32 capacity;
+    __u64 overflows;      /* Oldest records dropped because the ring was full */
+};
+
+/*
+ * Latest-sample page: mmap() one page at offset 0, read-only. The driver
+ * bumps `sequence` to an odd value before updating and back to even after,
+ * so a reader retries while it is odd or when it changed during the copy.
+ */
+struct bh1750_shared {
+    __u32 sequence;       /* Seqlock counter, not the sample number */
+    __u32 seq;            /* Acquisition sequence number */
+    __u64 timestamp_ns;   /* CLOCK_REALTIME at acquisition */
+    __u32 millilux;
+    __u16 raw;
+    __u16 reserved;
+};
+
+#ifndef __KERNEL__
+/* Take a consistent copy of the shared page without any system call */
+static inline void bh1750_shared_read(const struct bh1750_shared *page, struct bh1750_shared *out)
+{
+    __u32 start;
+
+    for (;;) {
+        start = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (start & 1)
+            continue;
+        *out = *page;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == start)
+            return;
+    }
+}
+#endif
+
+/*
+ * Measurement modes (the sensor's own command codes). Worst-case conversion
+ * time and resolution at the default MTreg of 69:
+ *   CONT_HIGH / ONETIME_HIGH    180 ms   ~0.83 lx/count (1 lx nominal)
+ *   CONT_HIGH2 / ONETIME_HIGH2  180 ms   ~0.42 lx/count (0.5 lx nominal)
+ *   CONT_LOW / ONETIME_LOW       24 ms   ~3.33 lx/count (4 lx nominal)
+ * Conversion time scales with mtreg/69, resolution with 69/mtreg.
+ */
+#define BH1750_MODE_CONT_HIGH     0x10
+#define BH1750_MODE_CONT_HIGH2    0x11
+#define BH1750_MODE_CONT_LOW      0x13
+#define BH1750_MODE_ONETIME_HIGH  0x20
+#define BH1750_MODE_ONETIME_HIGH2 0x21
+#define BH1750_MODE_ONETIME_LOW   0x23
+
+#define BH1750_MTREG_MIN     31
+#define BH1750_MTREG_DEFAULT 69
+#define BH1750_MTREG_MAX     254
+
+struct bh1750_config {
+    __u8 mode;               /* BH1750_MODE_* */
+    __u8 mtreg;              /* Measurement time register, BH1750_MTREG_MIN..MAX */
+    __u8 auto_range;         /* 1: driver adjusts mtreg and H/H2 from each sample */
+    __u8 reserved;
+    /* Filled in by the driver for the resulting configuration */
+    __u32 conversion_us;     /* Worst-case conversion time (1 / max sample rate) */
+    __u32 resolution_mlx;    /* Millilux per count */
+    __u32 full_scale_mlx;    /* Millilux at 65535 counts */
+};
+
+#define BH1750_IOC_MAGIC 'B'
+#define BH1750_IOC_SET_FORMAT  _IOW(BH1750_IOC_MAGIC, 1, __u32)
+#define BH1750_IOC_FIFO_STATUS _IOR(BH1750_IOC_MAGIC, 2, struct bh1750_fifo_status)
+#define BH1750_IOC_FIFO_FLUSH  _IO(BH1750_IOC_MAGIC, 3)
+#define BH1750_IOC_GET_CONFIG  _IOR(BH1750_IOC_MAGIC, 4, struct bh1750_config)
+#define BH1750_IOC_SET_CONFIG  _IOWR(BH1750_IOC_MAGIC, 5, struct bh1750_config)
+
+#endif /* _BH1750_H */
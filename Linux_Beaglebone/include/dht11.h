@@ -0,0 +1,67 @@
+/*
+ * User-space interface of /dev/dht11, shared by driver_dht11.c and the
+ * applications (app.c is built with -I include).
+ */
+#ifndef _DHT11_H
+#define _DHT11_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* read() output format, selected per open file with DHT11_IOC_SET_FORMAT */
+#define DHT11_FORMAT_TEXT   0  /* "Temp: %dC, Hum: %d%%, ts: ..., seq: ..., age_ms: ...\n" */
+#define DHT11_FORMAT_BINARY 1  /* One struct dht11_record per read() */
+
+/*
+ * Binary sample. Fields describe the cached sample (seq == 0: none yet);
+ * `error` is the result of the most recent attempt, so a reader sees both
+ * the last good values and whether the sensor is currently failing.
+ */
+struct dht11_record {
+    __u64 timestamp_ns;       /* CLOCK_REALTIME at acquisition */
+    __u32 seq;                /* Successful read sequence number */
+    __s32 error;              /* 0 or -errno of the latest attempt */
+    __u32 age_ms;             /* Sample age when read() copied it */
+    __s16 temp_decicelsius;   /* data[2].data[3] in tenths of a degree */
+    __u16 hum_decipercent;    /* data[0].data[1] in tenths of a percent */
+    __u8 raw[5];              /* Bytes as received, checksum last */
+    __u8 reserved[3];
+};
+
+#define DHT11_IOC_MAGIC 'D'
+#define DHT11_IOC_SET_FORMAT _IOW(DHT11_IOC_MAGIC, 1, __u32)
+
+/*
+ * Latest-sample page: mmap() one page at offset 0, read-only. The driver
+ * bumps `sequence` to an odd value before updating and back to even after,
+ * so a reader retries while it is odd or when it changed during the copy.
+ */
+struct dht11_shared {
+    __u32 sequence;           /* Seqlock counter, not the sample number */
+    __u32 seq;                /* Successful read sequence number */
+    __u64 timestamp_ns;       /* CLOCK_REALTIME at acquisition */
+    __s16 temp_decicelsius;   /* data[2].data[3] in tenths of a degree */
+    __u16 hum_decipercent;    /* data[0].data[1] in tenths of a percent */
+    __u8 raw[5];              /* Bytes as received, checksum last */
+    __u8 reserved[3];
+};
+
+#ifndef __KERNEL__
+/* Take a consistent copy of the shared page without any system call */
+static inline void dht11_shared_read(const struct dht11_shared *page, struct dht11_shared *out)
+{
+    __u32 start;
+
+    for (;;) {
+        start = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (start & 1)
+            continue;
+        *out = *page;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == start)
+            return;
+    }
+}
+#endif
+
+#endif /* _DHT11_H */
@@ -0,0 +1,38 @@
+/*
+ * User-space interface of /dev/led, shared by driver_led.c and the
+ * applications (app.c is built with -I include).
+ */
+#ifndef _LED_H
+#define _LED_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* State word: one bit per LED, numbered like the "pin:state" text commands */
+#define LED_BIT(n)   (1U << ((n) - 1))
+#define LED1         LED_BIT(1)   /* Controlled from the web page */
+#define LED2         LED_BIT(2)   /* Temperature warning */
+#define LED_ALL      (LED1 | LED2)
+
+/* Set every LED in `mask` to its bit in `value`, others are left alone */
+struct led_batch {
+    __u32 mask;
+    __u32 value;
+};
+
+/*
+ * State change notification. `generation` is bumped by every write that
+ * changes the state word, whoever made it; poll() on /dev/led reports
+ * POLLIN while the file has not yet fetched the current generation.
+ */
+struct led_event {
+    __u32 state;
+    __u32 generation;
+};
+
+#define LED_IOC_MAGIC 'L'
+#define LED_IOC_SET       _IOW(LED_IOC_MAGIC, 1, struct led_batch)
+#define LED_IOC_GET_STATE _IOR(LED_IOC_MAGIC, 2, __u32)
+#define LED_IOC_GET_EVENT _IOR(LED_IOC_MAGIC, 3, struct led_event)  /* Marks it seen */
+
+#endif /* _LED_H */
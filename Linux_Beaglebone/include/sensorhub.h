@@ -0,0 +1,45 @@
+/*
+ * User-space interface of /dev/sensorhub, shared by driver_sensorhub.c and
+ * the applications (app.c is built with -I include).
+ *
+ * One snapshot holds the DHT11 and BH1750 samples and the LED state word,
+ * each with its own acquisition time, so a consumer gets everything for
+ * one message from a single system call:
+ *
+ *   read()                  the cached values as they are now, never blocks
+ *   SENSORHUB_IOC_ACQUIRE   starts a DHT11 and a BH1750 acquisition
+ *                           together, waits for both (bounded by the
+ *                           module's acquire_timeout_ms) and returns the
+ *                           snapshot. The DHT11 cannot be read more than
+ *                           once a second, so this may wait up to ~1 s.
+ */
+#ifndef _SENSORHUB_H
+#define _SENSORHUB_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#include "bh1750.h"
+#include "dht11.h"
+
+/* flags */
+#define SENSORHUB_DHT11_FRESH  (1U << 0)  /* dht11 was acquired by this call */
+#define SENSORHUB_BH1750_FRESH (1U << 1)  /* bh1750 was acquired by this call */
+
+struct sensorhub_snapshot {
+    __u64 timestamp_ns;           /* CLOCK_REALTIME when the snapshot was taken */
+    __u32 seq;                    /* Snapshot number, driver-wide */
+    __u32 flags;                  /* SENSORHUB_*_FRESH */
+    struct dht11_record dht11;    /* seq == 0: no sample yet; error as in /dev/dht11 */
+    struct bh1750_record bh1750;  /* seq == 0: no sample yet */
+    __s32 bh1750_error;           /* 0 or -errno of the latest BH1750 attempt */
+    __u32 led_state;              /* LED_BIT(n) mask, see led.h */
+    __u32 led_generation;
+    __u32 reserved;
+    __u64 led_timestamp_ns;       /* CLOCK_REALTIME of the last LED change, 0 if none */
+};
+
+#define SENSORHUB_IOC_MAGIC 'H'
+#define SENSORHUB_IOC_ACQUIRE _IOR(SENSORHUB_IOC_MAGIC, 1, struct sensorhub_snapshot)
+
+#endif /* _SENSORHUB_H */
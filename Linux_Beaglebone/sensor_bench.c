@@ -0,0 +1,447 @@
+/*
+ * sensor_bench - đo chi phí đọc các driver cảm biến từ user space.
+ *
+ *   sensor_bench bh1750 [count]
+ *       Đọc /dev/bh1750 count lần, in thời gian thực và CPU bận trung bình
+ *       mỗi lần đọc. Nạp driver với auto_refresh=0 để mỗi read() là một
+ *       giao dịch I2C thật, rồi so sánh use_hw_i2c=0 (bit-bang) với
+ *       use_hw_i2c=1 (I2C phần cứng).
+ *
+ *   sensor_bench bitbang [count]
+ *       Chạy phép đo bh1750 ở trên lần lượt với bus_khz=100 và 400 của engine
+ *       bit-bang (driver nạp với auto_refresh=0 use_hw_i2c=0), rồi trả lại
+ *       giá trị bus_khz cũ. Chạy "sensor_bench bh1750" với bản module trước
+ *       để có số liệu trước/sau.
+ *
+ *   sensor_bench dht11 [count]
+ *       Chờ count mẫu nền của /dev/dht11 với use_irq=N (polling) rồi use_irq=Y
+ *       (ngắt), in CPU bận mỗi mẫu và tỉ lệ lỗi, kèm bảng thống kê của driver
+ *       trong /sys/kernel/debug/dht11/stats (cần mount debugfs).
+ *
+ *   sensor_bench mmap [count]
+ *       So sánh chi phí lấy giá trị mới nhất: open/read/close + sscanf trên
+ *       /dev/bh1750 với việc đọc trang mmap (seqlock, không system call) của
+ *       /dev/bh1750 và /dev/dht11.
+ *
+ *   sensor_bench modes [seconds]
+ *       Lần lượt đặt từng chế độ/MTreg của BH1750 qua ioctl, đọc ring buffer
+ *       nhị phân trong khoảng thời gian cho trước và in tốc độ lấy mẫu đo được,
+ *       độ phân giải và độ nhiễu (độ lệch chuẩn) của từng chế độ.
+ *
+ * bitbang và dht11 in thêm /sys/kernel/debug/gpio1_core/stats (số lần ghi OE,
+ * tranh chấp khoá của bank GPIO1).
+ *
+ * Không có board: nạp gpio1_core.ko backend=sim trên kernel x86/QEMU bất kỳ
+ * rồi mới nạp các driver. Bank GPIO1 giả lập có sẵn một DHT11 và một BH1750
+ * trả lời đúng dạng sóng datasheet (sim_temp, sim_hum, sim_lux chỉnh giá trị),
+ * nên bitbang và dht11 (chỉ polling, use_irq=Y tự lùi về polling) chạy được
+ * y như trên board; số liệu khi đó đo chi phí CPU của driver chứ không phải
+ * của bus thật.
+ *
+ * CPU bận được lấy từ dòng "cpu" trong /proc/stat (toàn hệ thống), nên tính
+ * cả thời gian chạy trong kworker, IRQ và softirq chứ không chỉ trong thread
+ * gọi read(). Chạy trên board không tải để số liệu có ý nghĩa.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <math.h>
+#include <bh1750.h>
+#include <dht11.h>
+
+#define BH1750_DEVICE_PATH "/dev/bh1750"
+#define DHT11_DEVICE_PATH "/dev/dht11"
+#define BH1750_AUTO_REFRESH_PARAM "/sys/module/bh1750_1/parameters/auto_refresh"
+#define BH1750_REFRESH_PARAM "/sys/module/bh1750_1/parameters/refresh_interval"
+#define BH1750_BUS_KHZ_PARAM "/sys/module/bh1750_1/parameters/bus_khz"
+#define DHT11_USE_IRQ_PARAM "/sys/module/dht11/parameters/use_irq"
+#define DHT11_STATS_PATH "/sys/kernel/debug/dht11/stats"
+#define GPIO1_STATS_PATH "/sys/kernel/debug/gpio1_core/stats"
+#define BH1750_FASTEST_REFRESH "10"   /* ms, worker is still capped by the conversion time */
+#define DEFAULT_COUNT 200
+#define DHT11_SAMPLE_TIMEOUT_MS 10000 /* Driver lấy mẫu mỗi 2 s, cảm biến hỏng thì thôi chờ */
+
+static long long mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long mono_us(void) {
+    return mono_ns() / 1000;
+}
+
+/* Map page 0 of a sensor device read-only, NULL on failure */
+static const void *map_page(const char *path) {
+    void *page;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    page = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(page == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return page;
+}
+
+/* Tổng thời gian CPU bận của hệ thống (µs) theo /proc/stat */
+static long long cpu_busy_us(void) {
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal = 0;
+    long hz = sysconf(_SC_CLK_TCK);
+    FILE *fp = fopen("/proc/stat", "r");
+    int n;
+
+    if(!fp)
+        return -1;
+    n = fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+    fclose(fp);
+    if(n < 7 || hz <= 0)
+        return -1;
+    return (long long)((user + nice + system + irq + softirq + steal) * 1000000ULL / hz);
+}
+
+static void warn_if_cached(void) {
+    char value = 0;
+    FILE *fp = fopen(BH1750_AUTO_REFRESH_PARAM, "r");
+
+    if(!fp)
+        return;
+    if(fread(&value, 1, 1, fp) == 1 && value == 'Y')
+        fprintf(stderr, "Note: auto_refresh=Y, each read waits for the next background refresh;\n"
+                        "      wall time per read measures refresh_interval, not the bus\n");
+    fclose(fp);
+}
+
+static int bench_bh1750(int count) {
+    char buffer[64];
+    long long wall_start, wall_end, cpu_start, cpu_end;
+    int fd, failures = 0;
+
+    fd = open(BH1750_DEVICE_PATH, O_RDONLY);
+    if(fd < 0) {
+        perror("open " BH1750_DEVICE_PATH);
+        return -1;
+    }
+    warn_if_cached();
+
+    cpu_start = cpu_busy_us();
+    wall_start = mono_us();
+    for(int i = 0; i < count; i++) {
+        /* pread ở offset 0 để mỗi lần gọi đều lấy một mẫu mới */
+        if(pread(fd, buffer, sizeof(buffer) - 1, 0) <= 0)
+            failures++;
+    }
+    wall_end = mono_us();
+    cpu_end = cpu_busy_us();
+    close(fd);
+
+    printf("bh1750: %d reads, %d failed\n", count, failures);
+    printf("  wall:     %.1f us/read\n", (double)(wall_end - wall_start) / count);
+    if(cpu_start >= 0 && cpu_end >= 0)
+        printf("  cpu busy: %.1f us/read (system-wide)\n", (double)(cpu_end - cpu_start) / count);
+    return failures == count ? -1 : 0;
+}
+
+/* Đọc/ghi một tham số module dạng text, -1 nếu không truy cập được */
+static int read_param(const char *path, char *value, size_t len) {
+    FILE *fp = fopen(path, "r");
+
+    if(!fp)
+        return -1;
+    if(!fgets(value, (int)len, fp))
+        value[0] = '\0';
+    fclose(fp);
+    value[strcspn(value, "\n")] = '\0';
+    return value[0] ? 0 : -1;
+}
+
+static int write_param(const char *path, const char *value) {
+    FILE *fp = fopen(path, "w");
+    int ret;
+
+    if(!fp)
+        return -1;
+    ret = fputs(value, fp) < 0 ? -1 : 0;
+    if(fclose(fp) != 0)
+        ret = -1;
+    return ret;
+}
+
+static void dump_file(const char *path) {
+    char line[128];
+    FILE *fp = fopen(path, "r");
+
+    if(!fp) {
+        perror(path);
+        return;
+    }
+    while(fgets(line, sizeof(line), fp))
+        fputs(line, stdout);
+    fclose(fp);
+}
+
+static int bench_bitbang(int count) {
+    static const char *speeds[] = { "100", "400" };
+    char saved[16];
+    int ret = 0;
+
+    if(read_param(BH1750_BUS_KHZ_PARAM, saved, sizeof(saved)) < 0) {
+        perror(BH1750_BUS_KHZ_PARAM);
+        return -1;
+    }
+    for(size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        if(write_param(BH1750_BUS_KHZ_PARAM, speeds[i]) < 0) {
+            perror("set bus_khz");
+            ret = -1;
+            break;
+        }
+        printf("bus_khz=%s\n", speeds[i]);
+        if(bench_bh1750(count) < 0)
+            ret = -1;
+    }
+    write_param(BH1750_BUS_KHZ_PARAM, saved);
+    dump_file(GPIO1_STATS_PATH);
+    return ret;
+}
+
+static int bench_dht11(int count) {
+    static const char *modes[] = { "N", "Y" };
+    char saved[8], buffer[128];
+    int ret = 0;
+
+    if(read_param(DHT11_USE_IRQ_PARAM, saved, sizeof(saved)) < 0) {
+        perror(DHT11_USE_IRQ_PARAM);
+        return -1;
+    }
+    for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        long long cpu_start, cpu_end;
+        struct pollfd pfd;
+        int fd, samples = 0;
+
+        if(write_param(DHT11_USE_IRQ_PARAM, modes[m]) < 0) {
+            perror("set use_irq");
+            ret = -1;
+            break;
+        }
+        fd = open(DHT11_DEVICE_PATH, O_RDONLY);
+        if(fd < 0) {
+            perror("open " DHT11_DEVICE_PATH);
+            ret = -1;
+            break;
+        }
+        /* Lần đọc đầu trả về mẫu cache, các lần sau chờ mẫu nền tiếp theo.
+         * Lần đo lỗi không tạo mẫu mới, tỉ lệ lỗi lấy từ thống kê của driver. */
+        if(read(fd, buffer, sizeof(buffer) - 1) < 0)
+            perror("read " DHT11_DEVICE_PATH);
+        write_param(DHT11_STATS_PATH, "0");
+        cpu_start = cpu_busy_us();
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        for(int i = 0; i < count; i++) {
+            if(poll(&pfd, 1, DHT11_SAMPLE_TIMEOUT_MS) <= 0) {
+                fprintf(stderr, "use_irq=%s: no new sample within %d ms, stopping\n",
+                        modes[m], DHT11_SAMPLE_TIMEOUT_MS);
+                ret = -1;
+                break;
+            }
+            if(read(fd, buffer, sizeof(buffer) - 1) > 0)
+                samples++;
+        }
+        cpu_end = cpu_busy_us();
+        close(fd);
+        printf("use_irq=%s: %d samples, cpu busy %.0f us/sample (system-wide)\n",
+               modes[m], samples, samples ? (double)(cpu_end - cpu_start) / samples : 0.0);
+        dump_file(DHT11_STATS_PATH);
+    }
+    write_param(DHT11_USE_IRQ_PARAM, saved);
+    dump_file(GPIO1_STATS_PATH);
+    return ret;
+}
+
+static int bench_mmap(int count) {
+    const struct bh1750_shared *bh_page = map_page(BH1750_DEVICE_PATH);
+    const struct dht11_shared *dht_page = map_page(DHT11_DEVICE_PATH);
+    struct bh1750_shared bh;
+    struct dht11_shared dht;
+    char buffer[64];
+    unsigned int lux;
+    long long start, end;
+    volatile unsigned int sink = 0;
+
+    /* Cách app.c đang làm: mỗi lần đọc một vòng open/read/close và parse text */
+    start = mono_ns();
+    for(int i = 0; i < count; i++) {
+        int fd = open(BH1750_DEVICE_PATH, O_RDONLY);
+        ssize_t n;
+
+        if(fd < 0)
+            break;
+        n = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        if(n > 0) {
+            buffer[n] = '\0';
+            if(sscanf(buffer, "%u", &lux) == 1)
+                sink += lux;
+        }
+    }
+    end = mono_ns();
+    printf("bh1750 open/read/close: %.0f ns/read\n", (double)(end - start) / count);
+
+    if(bh_page) {
+        start = mono_ns();
+        for(int i = 0; i < count; i++) {
+            bh1750_shared_read(bh_page, &bh);
+            sink += bh.millilux;
+        }
+        end = mono_ns();
+        printf("bh1750 mmap:            %.0f ns/read (seq %u, %u mlx)\n",
+               (double)(end - start) / count, bh.seq, bh.millilux);
+    }
+    if(dht_page) {
+        start = mono_ns();
+        for(int i = 0; i < count; i++) {
+            dht11_shared_read(dht_page, &dht);
+            sink += dht.seq;
+        }
+        end = mono_ns();
+        printf("dht11 mmap:             %.0f ns/read (seq %u, %d.%d C)\n",
+               (double)(end - start) / count, dht.seq,
+               dht.temp_decicelsius / 10, dht.temp_decicelsius % 10);
+    }
+    (void)sink;
+    return (bh_page || dht_page) ? 0 : -1;
+}
+
+/* Đọc record nhị phân trong `seconds` giây, trả về số mẫu, trung bình và độ lệch chuẩn */
+static int collect_records(int fd, int seconds, double *mean, double *stddev) {
+    struct bh1750_record records[32];
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    long long deadline = mono_ns() + (long long)seconds * 1000000000LL;
+    double sum = 0, sum_sq = 0;
+    int total = 0;
+
+    ioctl(fd, BH1750_IOC_FIFO_FLUSH);
+    while(mono_ns() < deadline) {
+        ssize_t n;
+
+        if(poll(&pfd, 1, 500) <= 0)
+            continue;
+        n = read(fd, records, sizeof(records));
+        for(int i = 0; n > 0 && i < n / (ssize_t)sizeof(records[0]); i++) {
+            double v = records[i].millilux / 1000.0;
+            sum += v;
+            sum_sq += v * v;
+            total++;
+        }
+    }
+    *mean = total ? sum / total : 0;
+    *stddev = total > 1 ? sqrt((sum_sq - sum * sum / total) / (total - 1)) : 0;
+    return total;
+}
+
+static int bench_modes(int seconds) {
+    static const struct { unsigned char mode; const char *name; } modes[] = {
+        { BH1750_MODE_CONT_HIGH, "H" },
+        { BH1750_MODE_CONT_HIGH2, "H2" },
+        { BH1750_MODE_CONT_LOW, "L" },
+    };
+    static const unsigned char mtregs[] = { BH1750_MTREG_MIN, BH1750_MTREG_DEFAULT, BH1750_MTREG_MAX };
+    struct bh1750_config saved, cfg;
+    unsigned int format = BH1750_FORMAT_BINARY;
+    char refresh[16] = "";
+    FILE *fp;
+    int fd;
+
+    fd = open(BH1750_DEVICE_PATH, O_RDWR);
+    if(fd < 0) {
+        perror("open " BH1750_DEVICE_PATH);
+        return -1;
+    }
+    if(ioctl(fd, BH1750_IOC_GET_CONFIG, &saved) < 0 ||
+       ioctl(fd, BH1750_IOC_SET_FORMAT, &format) < 0) {
+        perror("ioctl");
+        close(fd);
+        return -1;
+    }
+    fp = fopen(BH1750_REFRESH_PARAM, "r");
+    if(fp) {
+        if(!fgets(refresh, sizeof(refresh), fp))
+            refresh[0] = '\0';
+        fclose(fp);
+    }
+    if(write(fd, BH1750_FASTEST_REFRESH, strlen(BH1750_FASTEST_REFRESH)) < 0)
+        perror("set refresh interval");
+
+    printf("mode mtreg  conv(ms)  res(lx)  full(lx)  rate(Hz)  mean(lx)  stddev(lx)\n");
+    for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        for(size_t t = 0; t < sizeof(mtregs); t++) {
+            double mean, stddev;
+            int samples;
+
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.mode = modes[m].mode;
+            cfg.mtreg = mtregs[t];
+            if(ioctl(fd, BH1750_IOC_SET_CONFIG, &cfg) < 0) {
+                perror("BH1750_IOC_SET_CONFIG");
+                continue;
+            }
+            samples = collect_records(fd, seconds, &mean, &stddev);
+            printf("%-4s %5u  %8.1f  %7.3f  %8.0f  %8.2f  %8.1f  %10.2f\n",
+                   modes[m].name, cfg.mtreg, cfg.conversion_us / 1000.0,
+                   cfg.resolution_mlx / 1000.0, cfg.full_scale_mlx / 1000.0,
+                   (double)samples / seconds, mean, stddev);
+        }
+    }
+
+    /* Trả lại cấu hình ban đầu */
+    saved.conversion_us = saved.resolution_mlx = saved.full_scale_mlx = 0;
+    ioctl(fd, BH1750_IOC_SET_CONFIG, &saved);
+    if(refresh[0] && write(fd, refresh, strcspn(refresh, "\n")) < 0)
+        perror("restore refresh interval");
+    close(fd);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s bh1750|bitbang|dht11|mmap [count]\n"
+                    "       %s modes [seconds]\n", prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+    int count = DEFAULT_COUNT;
+
+    if(argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(argc > 2)
+        count = atoi(argv[2]);
+    if(count <= 0)
+        count = DEFAULT_COUNT;
+
+    if(strcmp(argv[1], "bh1750") == 0)
+        return bench_bh1750(count) == 0 ? 0 : 1;
+    if(strcmp(argv[1], "bitbang") == 0)
+        return bench_bitbang(count) == 0 ? 0 : 1;
+    if(strcmp(argv[1], "dht11") == 0)
+        return bench_dht11(argc > 2 ? count : 20) == 0 ? 0 : 1;
+    if(strcmp(argv[1], "mmap") == 0)
+        return bench_mmap(count) == 0 ? 0 : 1;
+    if(strcmp(argv[1], "modes") == 0)
+        return bench_modes(argc > 2 ? count : 3) == 0 ? 0 : 1;
+
+    usage(argv[0]);
+    return 1;
+}
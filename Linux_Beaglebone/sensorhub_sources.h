@@ -0,0 +1,34 @@
+/*
+ * What the sensor and LED drivers export to driver_sensorhub.c. Kernel
+ * internal; user space sees the result through include/sensorhub.h.
+ *
+ * An acquisition is requested with *_hub_trigger(), which returns a ticket,
+ * and collected with *_hub_wait(ticket, timeout): it returns once an
+ * attempt that started after the trigger has finished, with that attempt's
+ * result (0 or -errno), -ETIMEDOUT or -ERESTARTSYS. Triggering several
+ * sensors before waiting on any of them lets their acquisitions overlap.
+ * *_hub_latest() copies the cached sample (seq == 0: none yet) and returns
+ * the last attempt's result.
+ */
+#ifndef _SENSORHUB_SOURCES_H
+#define _SENSORHUB_SOURCES_H
+
+#include <linux/types.h>
+
+#include "include/bh1750.h"
+#include "include/dht11.h"
+
+/* driver_bh1750.c */
+u32 bh1750_hub_trigger(void);
+int bh1750_hub_wait(u32 ticket, unsigned long timeout);
+int bh1750_hub_latest(struct bh1750_record *rec);
+
+/* driver_dht11.c: a trigger inside the sensor's 1 s minimum interval is delayed */
+u32 dht11_hub_trigger(void);
+int dht11_hub_wait(u32 ticket, unsigned long timeout);
+int dht11_hub_latest(struct dht11_record *rec);
+
+/* driver_led.c: state word, its generation and when it last changed (CLOCK_REALTIME) */
+u32 led_hub_state(u32 *generation, u64 *changed_ns);
+
+#endif /* _SENSORHUB_SOURCES_H */
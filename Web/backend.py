@@ -1,9 +1,19 @@
+import atexit
 import json
-import mysql.connector
-from flask import Flask, jsonify, request
+import queue
+import threading
+import time
+from flask import Flask, Response, jsonify, request
 from flask_cors import CORS
 from paho.mqtt.client import Client
 from datetime import datetime
+from db_pool import DBPool, PoolTimeout
+from ingest import IngestBuffer, DEFAULT_DEVICE
+from latest_state import LatestState
+from broadcast import Broadcaster
+from history import (parse_range, bucket_seconds, encode_cursor, decode_cursor,
+                     lttb, pick_source, align, LTTB_OVERSAMPLE, TIME_FORMAT)
+from retention import RetentionJob
 
 # MQTT cấu hình
 MQTT_BROKER = "192.168.6.1"
@@ -12,6 +22,7 @@ MQTT_USER = "toan"
 MQTT_PASS = "1"
 MQTT_SENSOR_TOPIC = "bbb/sensors"
 MQTT_LED_TOPIC = "bbb/led"
+MQTT_RULES_TOPIC = "bbb/rules"
 
 # MySQL cấu hình
 MYSQL_CONFIG = {
@@ -21,77 +32,214 @@ MYSQL_CONFIG = {
     "database": "sensor_system",
     'port': 3305  # Thay 3306 thành 33060
 }
+DB_POOL_SIZE = 8          # Số kết nối tối đa dùng chung cho HTTP và MQTT
+DB_POOL_TIMEOUT = 5.0     # Giây chờ kết nối rảnh trước khi trả 503
+
+# Ghi dữ liệu MQTT theo lô (ingest.py)
+INGEST_BATCH_SIZE = 200       # Flush khi đủ số bản ghi này...
+INGEST_FLUSH_INTERVAL = 0.5   # ...hoặc sau số giây này
+INGEST_MAX_QUEUE = 10000      # Số bản ghi tối đa chờ ghi trong RAM
+INGEST_OVERFLOW = "block"     # "block" | "drop" | "spool" khi hàng đợi đầy
+INGEST_SPOOL_PATH = None      # Ví dụ "ingest.spool": lô ghi lỗi được đổ ra file, nạp lại sau
+
+# Giữ dữ liệu (retention.py); rollup 1 giờ giữ vĩnh viễn
+RAW_KEEP_DAYS = 30            # Partition ngày của sensor_data/led_status
+ROLLUP_1M_KEEP_DAYS = 180
+RETENTION_INTERVAL = 3600     # Giây giữa hai lần chạy
+
+# Server-Sent Events (/api/stream)
+STREAM_MAX_CLIENTS = 100
+STREAM_KEEPALIVE = 15.0       # Giây; comment giữ kết nối và phát hiện client đã đóng
 
 app = Flask(__name__)
 CORS(app)
 
-def get_db_connection():
-    return mysql.connector.connect(**MYSQL_CONFIG)
+db_pool = DBPool(MYSQL_CONFIG, size=DB_POOL_SIZE, timeout=DB_POOL_TIMEOUT)
+# Trạng thái mới nhất của từng thiết bị, cập nhật từ MQTT (latest_state.py);
+# ingest điền stored_us vào sau khi commit
+latest = LatestState()
+ingest = IngestBuffer(db_pool, batch_size=INGEST_BATCH_SIZE,
+                      flush_interval=INGEST_FLUSH_INTERVAL, max_queue=INGEST_MAX_QUEUE,
+                      overflow=INGEST_OVERFLOW, spool_path=INGEST_SPOOL_PATH,
+                      on_stored=latest.mark_stored)
+ingest.start()
+atexit.register(ingest.close)
+retention = RetentionJob(db_pool, raw_keep_days=RAW_KEEP_DAYS,
+                         rollup_1m_keep_days=ROLLUP_1M_KEEP_DAYS, interval=RETENTION_INTERVAL)
+retention.start()
+
+latest_load_lock = threading.Lock()
+broadcaster = Broadcaster(max_clients=STREAM_MAX_CLIENTS)
+
+def ensure_latest_loaded():
+    # Khởi động lạnh: nạp bảng latest_state một lần, sau đó chỉ dùng bộ nhớ
+    if latest.loaded:
+        return
+    with latest_load_lock:
+        if latest.loaded:
+            return
+        with db_pool.connection() as db:
+            rows = db.query("""
+                SELECT device, temperature, humidity, lux, timestamp,
+                       bh1750_seq, bh1750_acq_us, dht11_seq, dht11_acq_us,
+                       read_us, pub_us, recv_us, stored_us, led1, led2
+                FROM latest_state
+            """)
+        latest.load_rows(rows)
+
+@app.errorhandler(PoolTimeout)
+def handle_pool_timeout(e):
+    return jsonify({"error": str(e)}), 503
+
+def now_us():
+    return int(time.time() * 1_000_000)
+
+# Các chặng trace theo thứ tự; mỗi độ trễ là hiệu giữa hai mốc liền kề
+TRACE_HOPS = [
+    ("acq_to_read", "bh1750_acq_us", "read_us"),
+    ("read_to_pub", "read_us", "pub_us"),
+    ("pub_to_recv", "pub_us", "recv_us"),
+    ("recv_to_stored", "recv_us", "stored_us"),
+    ("stored_to_served", "stored_us", "served_us"),
+]
+# Bản tin mới nhất chưa được ingest commit (stored_us còn None)
+CACHE_TRACE_HOPS = TRACE_HOPS[:3] + [("recv_to_served", "recv_us", "served_us")]
+
+def build_trace(row, served_us):
+    stamps = {k: row.get(k) for k in (
+        "bh1750_acq_us", "dht11_acq_us", "read_us", "pub_us", "recv_us", "stored_us")}
+    stamps["served_us"] = served_us
+
+    latency_ms = {}
+    hops = TRACE_HOPS if stamps["stored_us"] else CACHE_TRACE_HOPS
+    for name, start, end in hops:
+        if stamps.get(start) and stamps.get(end):
+            latency_ms[name] = round((stamps[end] - stamps[start]) / 1000.0, 3)
+    if stamps["bh1750_acq_us"]:
+        latency_ms["total"] = round((served_us - stamps["bh1750_acq_us"]) / 1000.0, 3)
+    if stamps["dht11_acq_us"] and stamps["pub_us"]:
+        # Mẫu DHT11 được app cache, tuổi của nó lúc publish
+        latency_ms["dht11_age_at_pub"] = round((stamps["pub_us"] - stamps["dht11_acq_us"]) / 1000.0, 3)
+
+    return {
+        "bh1750_seq": row.get("bh1750_seq"),
+        "dht11_seq": row.get("dht11_seq"),
+        "stamps_us": stamps,
+        "latency_ms": latency_ms,
+    }
+
+def latest_payload(row):
+    if not row or row.get('timestamp') is None:
+        return None
+    return {
+        "device": row['device'],
+        "temperature": int(round(row['temperature'])),
+        "humidity": int(round(row['humidity'])),
+        "lux": int(round(row['lux'])),
+        "led1": row.get('led1', "OFF"),
+        "led2": row.get('led2', "OFF"),
+        "timestamp": row['timestamp'].strftime('%Y-%m-%d %H:%M:%S'),
+        "seq": row.get('bh1750_seq'),
+        # Không có bản tin nào trong latest.stale_after giây
+        "stale": row['stale'],
+        "age_s": row['age_s'],
+        "trace": build_trace(row, now_us())
+    }
+
+def push_latest(device=None):
+    payload = latest_payload(latest.get(device))
+    if payload:
+        broadcaster.publish("latest", payload, payload["device"])
 
 @app.route('/api/latest', methods=['GET'])
 def get_latest():
-    db = get_db_connection()
-    cursor = db.cursor(dictionary=True)
+    ensure_latest_loaded()
+    payload = latest_payload(latest.get(request.args.get("device")))
+    if payload:
+        return jsonify(payload)
+    else:
+        return jsonify({"error": "No data found"})
+
+@app.route('/api/stream', methods=['GET'])
+def stream():
+    """
+    Đẩy sự kiện "latest" (cùng nội dung /api/latest) mỗi khi có bản tin hoặc
+    lệnh LED; có ?device= thì chỉ sự kiện của thiết bị đó.
+    """
+    device = request.args.get("device")
+    client = broadcaster.subscribe(device)
+    if client is None:
+        return jsonify({"error": "too many stream clients"}), 503
     try:
-        cursor.execute("""
-            SELECT s.temperature, s.humidity, s.lux, s.timestamp,
-                   COALESCE(l.led1, 'OFF') as led1,
-                   COALESCE(l.led2, 'OFF') as led2
-            FROM sensor_data s
-            LEFT JOIN led_status l
-              ON l.timestamp = (
-                  SELECT MAX(timestamp)
-                  FROM led_status
-                  WHERE timestamp <= s.timestamp
-              )
-            ORDER BY s.id DESC LIMIT 1
-        """)
-        row = cursor.fetchone()
-        if row:
-            return jsonify({
-                "temperature": int(round(row['temperature'])),
-                "humidity": int(round(row['humidity'])),
-                "lux": int(round(row['lux'])),
-                "led1": row['led1'],
-                "led2": row['led2'],
-                "timestamp": row['timestamp'].strftime('%Y-%m-%d %H:%M:%S')
-            })
-        else:
-            return jsonify({"error": "No data found"})
-    finally:
-        cursor.close()
-        db.close()
+        ensure_latest_loaded()
+        initial = latest_payload(latest.get(device))
+    except Exception:
+        broadcaster.unsubscribe(client)
+        raise
+
+    def events():
+        yield "retry: 3000\n\n"
+        if initial:
+            yield Broadcaster.format("latest", initial)
+        while True:
+            try:
+                yield client.get(timeout=STREAM_KEEPALIVE)
+            except queue.Empty:
+                yield ": keepalive\n\n"
+
+    response = Response(events(), mimetype='text/event-stream',
+                        headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
+    # Chạy cả khi kết nối đóng trước khi generator kịp bắt đầu
+    response.call_on_close(lambda: broadcaster.unsubscribe(client))
+    return response
+
+@app.route('/api/devices', methods=['GET'])
+def get_devices():
+    ensure_latest_loaded()
+    return jsonify(latest.devices())
 
 @app.route('/api/led', methods=['POST'])
 def update_led():
     data = request.json or {}
     led1 = data.get("led1")
     led2 = data.get("led2")
+    device = data.get("device")
 
-    db = get_db_connection()
-    cursor = db.cursor()
-    try:
-        cursor.execute("SELECT led1, led2 FROM led_status ORDER BY timestamp DESC LIMIT 1")
-        latest = cursor.fetchone()
-        led1_current = latest[0] if latest else "OFF"
-        led2_current = latest[1] if latest else "OFF"
+    ensure_latest_loaded()
+    current = latest.get(device) or {}
+    led1_current = current.get('led1', "OFF")
+    led2_current = current.get('led2', "OFF")
 
-        # Nếu không gửi từ Web, giữ nguyên trạng thái cũ
-        led1 = led1.upper() if led1 is not None else led1_current
-        led2 = led2.upper() if led2 is not None else led2_current
+    # Nếu không gửi từ Web, giữ nguyên trạng thái cũ
+    led1 = led1.upper() if led1 is not None else led1_current
+    led2 = led2.upper() if led2 is not None else led2_current
 
-        mqtt_payload = {"led1": led1, "led2": led2}
-        mqtt_client.publish(MQTT_LED_TOPIC, json.dumps(mqtt_payload))
-        print(f"[MQTT → Device] Gửi trạng thái từ Web: {mqtt_payload}")
+    mqtt_payload = {"led1": led1, "led2": led2}
+    mqtt_client.publish(MQTT_LED_TOPIC, json.dumps(mqtt_payload))
+    print(f"[MQTT → Device] Gửi trạng thái từ Web: {mqtt_payload}")
+    latest.update_led(led1, led2, device)
+    # Lệnh không chỉ rõ device áp cho mọi thiết bị: báo cho client của từng thiết bị
+    for name in ([device] if device else latest.devices()):
+        push_latest(name)
 
-        cursor.execute(
+    with db_pool.connection() as db:
+        db.begin()
+        db.execute(
             "INSERT INTO led_status (led1, led2) VALUES (%s, %s)",
             (led1, led2)
         )
+        # Lệnh LED gửi chung một topic nên áp cho mọi thiết bị, trừ khi chỉ rõ device
+        if device:
+            db.execute(
+                "UPDATE latest_state SET led1 = %s, led2 = %s, led_timestamp = NOW() WHERE device = %s",
+                (led1, led2, device)
+            )
+        else:
+            db.execute(
+                "UPDATE latest_state SET led1 = %s, led2 = %s, led_timestamp = NOW()",
+                (led1, led2)
+            )
         db.commit()
-    finally:
-        cursor.close()
-        db.close()
 
     return jsonify({
         "success": True,
@@ -99,92 +247,269 @@ def update_led():
         "led2": led2
     })
 
+@app.route('/api/rules', methods=['POST'])
+def update_rules():
+    data = request.json or {}
+    rules = data.get("rules")
+    if not isinstance(rules, list):
+        return jsonify({"success": False, "error": "rules must be a list"}), 400
+
+    # Retain để thiết bị nhận lại bộ rule mỗi khi kết nối lại broker
+    mqtt_payload = {"rules": rules}
+    mqtt_client.publish(MQTT_RULES_TOPIC, json.dumps(mqtt_payload), qos=1, retain=True)
+    print(f"[MQTT → Device] Gửi rule: {mqtt_payload}")
+
+    return jsonify({
+        "success": True,
+        "rules": rules
+    })
+
+SENSOR_FIELDS = ("temperature", "humidity", "lux")
+
+def page_after(args, start):
+    # Keyset: tiếp tục sau (timestamp, id) của dòng cuối trang trước
+    if args.get("cursor"):
+        return decode_cursor(args["cursor"])
+    return start, 0
+
 @app.route('/api/history_sensors', methods=['GET'])
 def get_sensor_history():
-    db = get_db_connection()
-    cursor = db.cursor(dictionary=True)
-    try:
-        cursor.execute("""
-            SELECT temperature, humidity, lux, timestamp
-            FROM sensor_data
-            ORDER BY id DESC
-            LIMIT 10
-        """)
-        rows = cursor.fetchall()
+    """
+    Không tham số: 10 bản ghi mới nhất. Có from/to/max_points/mode thì trả
+    theo khoảng thời gian, tối đa max_points điểm:
+      mode=minmax (mặc định): bucket đều theo thời gian, min/max/avg mỗi trường
+      mode=lttb: chọn điểm bằng LTTB trên các bucket trung bình
+      mode=raw: bản ghi gốc, phân trang keyset bằng cursor
+    """
+    if not request.args:
+        with db_pool.connection() as db:
+            rows = db.query("""
+                SELECT temperature, humidity, lux, timestamp
+                FROM sensor_data
+                ORDER BY id DESC
+                LIMIT 10
+            """)
         return jsonify([
             {
                 "temperature": float(row['temperature']),
                 "humidity": float(row['humidity']),
                 "lux": float(row['lux']),
-                "timestamp": row['timestamp'].strftime('%Y-%m-%d %H:%M:%S')
+                "timestamp": row['timestamp'].strftime(TIME_FORMAT)
             } for row in rows
         ])
-    finally:
-        cursor.close()
-        db.close()
+
+    try:
+        start, end, max_points = parse_range(request.args)
+        mode = request.args.get("mode", "minmax")
+        if mode == "raw":
+            after_ts, after_id = page_after(request.args, start)
+        elif mode not in ("minmax", "lttb"):
+            raise ValueError("mode must be minmax, lttb or raw")
+    except ValueError as e:
+        return jsonify({"error": str(e)}), 400
+
+    result = {"mode": mode, "from": start.strftime(TIME_FORMAT), "to": end.strftime(TIME_FORMAT)}
+    if mode == "raw":
+        with db_pool.connection() as db:
+            rows = db.query("""
+                SELECT id, temperature, humidity, lux, timestamp
+                FROM sensor_data
+                WHERE timestamp < %s
+                  AND (timestamp > %s OR (timestamp = %s AND id > %s))
+                ORDER BY timestamp, id
+                LIMIT %s
+            """, (end, after_ts, after_ts, after_id, max_points + 1))
+        more = len(rows) > max_points
+        rows = rows[:max_points]
+        result["rows"] = [
+            {
+                "temperature": float(row['temperature']),
+                "humidity": float(row['humidity']),
+                "lux": float(row['lux']),
+                "timestamp": row['timestamp'].strftime(TIME_FORMAT)
+            } for row in rows
+        ]
+        result["next"] = encode_cursor(rows[-1]) if more else None
+        return jsonify(result)
+
+    # Gom nhóm trong MySQL: chỉ tối đa `buckets` dòng rời CSDL. Bucket từ 1 phút
+    # trở lên đọc từ rollup thô nhất còn đủ độ phân giải thay vì quét sensor_data
+    buckets = max_points if mode == "minmax" else max_points * LTTB_OVERSAMPLE
+    bucket_s = bucket_seconds(start, end, buckets)
+    source, sql, width = pick_source(bucket_s, start, datetime.now(), {
+        "raw": RAW_KEEP_DAYS, "rollup_1m": ROLLUP_1M_KEEP_DAYS, "rollup_1h": None})
+    bucket_s, origin = align(start, bucket_s, width)
+    with db_pool.connection() as db:
+        rows = db.query(sql, (origin, bucket_s, datetime.fromtimestamp(origin), end))
+    result["source"] = source
+    result["bucket_s"] = bucket_s
+
+    if mode == "minmax":
+        result["points"] = [
+            {
+                "timestamp": row['timestamp'].strftime(TIME_FORMAT),
+                "count": int(row['count']),
+                **{f: {
+                    "avg": round(float(row[f + '_avg']), 2),
+                    "min": float(row[f + '_min']),
+                    "max": float(row[f + '_max']),
+                } for f in SENSOR_FIELDS}
+            } for row in rows
+        ]
+    else:
+        result["series"] = {}
+        for f in SENSOR_FIELDS:
+            points = [(row['timestamp'], float(row[f + '_avg'])) for row in rows]
+            # LTTB cần trục x là số
+            picked = lttb([(ts.timestamp(), v) for ts, v in points], max_points)
+            by_x = {ts.timestamp(): ts for ts, _ in points}
+            result["series"][f] = [
+                {"timestamp": by_x[x].strftime(TIME_FORMAT), "value": round(v, 2)}
+                for x, v in picked
+            ]
+    return jsonify(result)
 
 @app.route('/api/history_led', methods=['GET'])
 def get_led_history():
-    db = get_db_connection()
-    cursor = db.cursor(dictionary=True)
-    try:
-        cursor.execute("""
-            SELECT led1, led2, timestamp
-            FROM led_status
-            ORDER BY id DESC
-            LIMIT 10
-        """)
-        rows = cursor.fetchall()
+    """
+    Không tham số: 10 bản ghi mới nhất. Có from/to/max_points thì trả tối đa
+    max_points dòng, phân trang keyset bằng cursor:
+      mode=changes (mặc định): chỉ các lần LED đổi trạng thái
+      mode=raw: mọi bản ghi
+    """
+    if not request.args:
+        with db_pool.connection() as db:
+            rows = db.query("""
+                SELECT led1, led2, timestamp
+                FROM led_status
+                ORDER BY id DESC
+                LIMIT 10
+            """)
         return jsonify([
             {
                 "led1": row['led1'],
                 "led2": row['led2'],
-                "timestamp": row['timestamp'].strftime('%Y-%m-%d %H:%M:%S')
+                "timestamp": row['timestamp'].strftime(TIME_FORMAT)
             } for row in rows
         ])
-    finally:
-        cursor.close()
-        db.close()
+
+    try:
+        start, end, max_points = parse_range(request.args)
+        mode = request.args.get("mode", "changes")
+        if mode not in ("changes", "raw"):
+            raise ValueError("mode must be changes or raw")
+        after_ts, after_id = page_after(request.args, start)
+    except ValueError as e:
+        return jsonify({"error": str(e)}), 400
+
+    with db_pool.connection() as db:
+        if mode == "raw":
+            rows = db.query("""
+                SELECT id, led1, led2, timestamp
+                FROM led_status
+                WHERE timestamp < %s
+                  AND (timestamp > %s OR (timestamp = %s AND id > %s))
+                ORDER BY timestamp, id
+                LIMIT %s
+            """, (end, after_ts, after_ts, after_id, max_points + 1))
+        else:
+            # Cửa sổ bắt đầu từ dòng cursor để dòng đầu trang sau so được với nó
+            rows = db.query("""
+                SELECT id, led1, led2, timestamp
+                FROM (
+                    SELECT id, led1, led2, timestamp,
+                           LAG(led1) OVER w AS prev_led1,
+                           LAG(led2) OVER w AS prev_led2
+                    FROM led_status
+                    WHERE timestamp < %s
+                      AND (timestamp > %s OR (timestamp = %s AND id >= %s))
+                    WINDOW w AS (ORDER BY timestamp, id)
+                ) t
+                WHERE id <> %s
+                  AND (prev_led1 IS NULL OR prev_led1 <> led1 OR prev_led2 <> led2)
+                ORDER BY timestamp, id
+                LIMIT %s
+            """, (end, after_ts, after_ts, after_id, after_id, max_points + 1))
+
+    more = len(rows) > max_points
+    rows = rows[:max_points]
+    return jsonify({
+        "mode": mode,
+        "from": start.strftime(TIME_FORMAT),
+        "to": end.strftime(TIME_FORMAT),
+        "rows": [
+            {
+                "led1": row['led1'],
+                "led2": row['led2'],
+                "timestamp": row['timestamp'].strftime(TIME_FORMAT)
+            } for row in rows
+        ],
+        "next": encode_cursor(rows[-1]) if more else None,
+    })
+
+@app.route('/api/metrics', methods=['GET'])
+def get_metrics():
+    return jsonify({"db_pool": db_pool.metrics(), "ingest": ingest.metrics(),
+                    "stream": broadcaster.metrics(), "retention": retention.metrics()})
+
+def as_number(value, cast=float):
+    """Số từ JSON của thiết bị, None nếu thiếu hoặc không phải số."""
+    if value is None or isinstance(value, bool):
+        return None
+    try:
+        number = cast(value)
+    except (TypeError, ValueError, OverflowError):
+        return None
+    return number if number == number else None    # Bỏ NaN
 
 def on_message(client, userdata, msg):
+    recv_us = now_us()
     try:
         payload = msg.payload.decode()
         data = json.loads(payload)
 
-        temperature = data.get("temperature", 0)
-        humidity = data.get("humidity", 0)
-        lux = data.get("lux", 0)
+        # Bản tin sai kiểu bị bỏ ở đây, không để lọt vào lô ghi CSDL
+        temperature = as_number(data.get("temperature", 0))
+        humidity = as_number(data.get("humidity", 0))
+        lux = as_number(data.get("lux", 0))
+        if None in (temperature, humidity, lux):
+            print(f"[MQTT Received] Bỏ bản tin có giá trị không phải số: {payload}")
+            return
+        trace = data.get("trace")
+        trace = {k: as_number(v, int) for k, v in trace.items()} if isinstance(trace, dict) else {}
+        device = str(data.get("device") or DEFAULT_DEVICE)[:32]
 
         print(f"[MQTT Received] Temp: {temperature}, Humidity: {humidity}, Lux: {lux}, Time: {datetime.now()}")
 
-        led2_status = "ON" if temperature > 27 else "OFF"
+        # LED2 do rule engine trên thiết bị điều khiển, backend chỉ ghi nhận trạng thái gửi lên
+        led2_status = data.get("led2", "ON" if temperature > 27 else "OFF")
 
-        db = get_db_connection()
-        cursor = db.cursor()
-        try:
-            # Lấy trạng thái hiện tại của led1 từ CSDL
-            cursor.execute("SELECT led1 FROM led_status ORDER BY timestamp DESC LIMIT 1")
-            result = cursor.fetchone()
-            led1_status = result[0] if result else "OFF"
+        led1_status = data.get("led1")
+        if led1_status is None:
+            # Thiết bị cũ không gửi led1: dùng trạng thái đã biết
+            ensure_latest_loaded()
+            led1_status = latest.led1(device) or "OFF"
 
-            mqtt_payload = {"led1": led1_status, "led2": led2_status}
-            mqtt_client.publish(MQTT_LED_TOPIC, json.dumps(mqtt_payload))
-            print(f"[MQTT → Device] Gửi từ cảm biến: {mqtt_payload}")
+        sensor_row = (temperature, humidity, lux,
+                      trace.get("bh1750_seq"), trace.get("bh1750_acq"),
+                      trace.get("dht11_seq"), trace.get("dht11_acq"),
+                      trace.get("read"), trace.get("pub"), recv_us)
+        latest.update_reading(device, {
+            "temperature": temperature, "humidity": humidity, "lux": lux,
+            "timestamp": datetime.now(),
+            "bh1750_seq": trace.get("bh1750_seq"), "bh1750_acq_us": trace.get("bh1750_acq"),
+            "dht11_seq": trace.get("dht11_seq"), "dht11_acq_us": trace.get("dht11_acq"),
+            "read_us": trace.get("read"), "pub_us": trace.get("pub"),
+            "recv_us": recv_us, "stored_us": None,
+            "led1": led1_status, "led2": led2_status,
+        })
+        push_latest(device)
 
-            # Lưu dữ liệu
-            cursor.execute(
-                "INSERT INTO sensor_data (temperature, humidity, lux) VALUES (%s, %s, %s)",
-                (temperature, humidity, lux)
-            )
-            cursor.execute(
-                "INSERT INTO led_status (led1, led2) VALUES (%s, %s)",
-                (led1_status, led2_status)
-            )
-            db.commit()
-            print(f"[DB] Đã lưu trạng thái: LED1 = {led1_status}, LED2 = {led2_status}")
-        finally:
-            cursor.close()
-            db.close()
+        # Đưa vào hàng đợi, luồng ingest ghi theo lô (stored_us điền sau commit)
+        if ingest.put(sensor_row, (led1_status, led2_status), device):
+            print(f"[INGEST] Đã xếp hàng: {device} LED1 = {led1_status}, LED2 = {led2_status}")
+        else:
+            print("[INGEST] Hàng đợi đầy, bỏ bản ghi")
     except Exception as e:
         import traceback
         print("❌ Lỗi xử lý dữ liệu MQTT:", e)
@@ -0,0 +1,107 @@
+"""
+Đo tốc độ ghi bản tin cảm biến (rows/s) theo hai cách:
+  - per_message: như on_message() cũ, mỗi bản tin một kết nối mới,
+    SELECT led1 + 2 INSERT + commit + UPDATE stored_us
+  - batched: IngestBuffer (ingest.py) ghi theo lô qua DBPool
+
+Chạy trên CSDL riêng để không lẫn dữ liệu thật, bảng được tạo theo cấu trúc
+của sensor_system:
+    python3 bench_ingest.py --rows 5000 --database sensor_system_bench
+"""
+import argparse
+import time
+from datetime import datetime
+
+import mysql.connector
+
+from db_pool import DBPool
+from ingest import IngestBuffer, SENSOR_INSERT, LED_INSERT, now_us
+
+BASE_CONFIG = {
+    "host": "localhost",
+    "user": "root",
+    "password": "123456",
+    "port": 3305,
+}
+
+
+def prepare_database(config, source_db):
+    conn = mysql.connector.connect(**{k: v for k, v in config.items() if k != "database"})
+    cursor = conn.cursor()
+    cursor.execute(f"CREATE DATABASE IF NOT EXISTS `{config['database']}`")
+    for table in ("sensor_data", "led_status", "latest_state",
+                  "sensor_rollup_1m", "sensor_rollup_1h"):
+        cursor.execute(f"CREATE TABLE IF NOT EXISTS `{config['database']}`.{table} "
+                       f"LIKE `{source_db}`.{table}")
+        cursor.execute(f"TRUNCATE TABLE `{config['database']}`.{table}")
+    cursor.close()
+    conn.close()
+
+
+def sample(i):
+    t = now_us()
+    return ((25 + i % 10, 60 + i % 20, 300 + i % 500,
+             i, t - 3000, i, t - 500000, t - 2000, t - 1000, t),
+            ("ON" if i % 2 else "OFF", "OFF"))
+
+
+def bench_per_message(config, rows):
+    start = time.monotonic()
+    for i in range(rows):
+        sensor_row, led_row = sample(i)
+        db = mysql.connector.connect(**config)
+        cursor = db.cursor()
+        try:
+            cursor.execute("SELECT led1 FROM led_status ORDER BY timestamp DESC LIMIT 1")
+            cursor.fetchone()
+            received = datetime.now()
+            cursor.execute(SENSOR_INSERT, sensor_row + (None, received))
+            row_id = cursor.lastrowid
+            cursor.execute(LED_INSERT, led_row + (received,))
+            db.commit()
+            cursor.execute("UPDATE sensor_data SET stored_us = %s WHERE id = %s", (now_us(), row_id))
+            db.commit()
+        finally:
+            cursor.close()
+            db.close()
+    return rows / (time.monotonic() - start)
+
+
+def bench_batched(config, rows, batch_size, flush_interval):
+    pool = DBPool(config, size=4)
+    ingest = IngestBuffer(pool, batch_size=batch_size, flush_interval=flush_interval,
+                          max_queue=max(rows, batch_size))
+    ingest.start()
+    start = time.monotonic()
+    for i in range(rows):
+        ingest.put(*sample(i))
+    ingest.close(timeout=None)
+    elapsed = time.monotonic() - start
+    return rows / elapsed, ingest.metrics()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--rows", type=int, default=2000)
+    parser.add_argument("--batch-size", type=int, default=200)
+    parser.add_argument("--flush-interval", type=float, default=0.5)
+    parser.add_argument("--database", default="sensor_system_bench")
+    parser.add_argument("--source-database", default="sensor_system")
+    args = parser.parse_args()
+
+    config = dict(BASE_CONFIG, database=args.database)
+    prepare_database(config, args.source_database)
+
+    before = bench_per_message(config, args.rows)
+    after, metrics = bench_batched(config, args.rows, args.batch_size, args.flush_interval)
+
+    print(f"rows={args.rows} batch_size={args.batch_size}")
+    print(f"  per_message: {before:10.1f} rows/s")
+    print(f"  batched:     {after:10.1f} rows/s  ({after / before:.1f}x)")
+    print(f"  batches={metrics['batches']} avg_batch={metrics['avg_batch']} "
+          f"flush_ms_avg={metrics['flush_ms_avg']} flush_ms_max={metrics['flush_ms_max']}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,186 @@
+"""
+Đo thời gian truy vấn của /api/latest và /api/history_* trên tập dữ liệu
+giả lớn, trước và sau migrations/002_latest_state.sql:
+  1. tạo bảng sensor_data/led_status như database.sql (chưa có index)
+     và sinh --rows bản ghi mỗi bảng
+  2. đo các truy vấn cũ
+  3. chạy migration 002 rồi đo các truy vấn mới
+
+Chạy trên CSDL riêng, ví dụ 10 triệu bản ghi:
+    python3 bench_latest.py --rows 10000000 --database sensor_system_bench
+"""
+import argparse
+import os
+import random
+import statistics
+import time
+
+import mysql.connector
+
+BASE_CONFIG = {
+    "host": "localhost",
+    "user": "root",
+    "password": "123456",
+    "port": 3305,
+}
+MIGRATION = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         "migrations", "002_latest_state.sql")
+INSERT_CHUNK = 10000
+
+SCHEMA = [
+    """CREATE TABLE sensor_data (
+        id INT AUTO_INCREMENT PRIMARY KEY,
+        temperature FLOAT NOT NULL,
+        humidity FLOAT NOT NULL,
+        lux FLOAT NOT NULL,
+        timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+        bh1750_seq INT UNSIGNED NULL,
+        bh1750_acq_us BIGINT NULL,
+        dht11_seq INT UNSIGNED NULL,
+        dht11_acq_us BIGINT NULL,
+        read_us BIGINT NULL,
+        pub_us BIGINT NULL,
+        recv_us BIGINT NULL,
+        stored_us BIGINT NULL
+    )""",
+    """CREATE TABLE led_status (
+        id INT AUTO_INCREMENT PRIMARY KEY,
+        led1 VARCHAR(3) NOT NULL,
+        led2 VARCHAR(3) NOT NULL,
+        timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
+    )""",
+]
+
+OLD_QUERIES = {
+    "latest": """
+        SELECT s.temperature, s.humidity, s.lux, s.timestamp,
+               s.bh1750_seq, s.bh1750_acq_us, s.dht11_seq, s.dht11_acq_us,
+               s.read_us, s.pub_us, s.recv_us, s.stored_us,
+               COALESCE(l.led1, 'OFF') as led1,
+               COALESCE(l.led2, 'OFF') as led2
+        FROM sensor_data s
+        LEFT JOIN led_status l
+          ON l.timestamp = (
+              SELECT MAX(timestamp)
+              FROM led_status
+              WHERE timestamp <= s.timestamp
+          )
+        ORDER BY s.id DESC LIMIT 1""",
+    "led_current": "SELECT led1, led2 FROM led_status ORDER BY timestamp DESC LIMIT 1",
+    "history_sensors": """SELECT temperature, humidity, lux, timestamp
+                          FROM sensor_data ORDER BY id DESC LIMIT 10""",
+    "history_led": "SELECT led1, led2, timestamp FROM led_status ORDER BY id DESC LIMIT 10",
+}
+
+NEW_QUERIES = {
+    "latest": """
+        SELECT temperature, humidity, lux, timestamp,
+               bh1750_seq, bh1750_acq_us, dht11_seq, dht11_acq_us,
+               read_us, pub_us, recv_us, stored_us, led1, led2
+        FROM latest_state WHERE device = 'default'""",
+    "led_current": "SELECT led1, led2 FROM latest_state WHERE device = 'default'",
+    "history_sensors": OLD_QUERIES["history_sensors"],
+    "history_led": OLD_QUERIES["history_led"],
+}
+
+
+def populate(conn, rows):
+    cursor = conn.cursor()
+    start_s = int(time.time()) - rows * 5    # Một mẫu mỗi 5 giây
+    print(f"Sinh {rows} bản ghi mỗi bảng...")
+    for base in range(0, rows, INSERT_CHUNK):
+        n = min(INSERT_CHUNK, rows - base)
+        sensor, led = [], []
+        for i in range(base, base + n):
+            ts = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(start_s + i * 5))
+            us = (start_s + i * 5) * 1_000_000
+            sensor.append((20 + random.random() * 15, 40 + random.random() * 40,
+                           random.random() * 1000, ts,
+                           i, us - 3000, i, us - 500000, us - 2000, us - 1000, us, us + 500))
+            led.append(("ON" if i % 7 else "OFF", "ON" if i % 3 else "OFF", ts))
+        cursor.executemany(
+            """INSERT INTO sensor_data
+               (temperature, humidity, lux, timestamp,
+                bh1750_seq, bh1750_acq_us, dht11_seq, dht11_acq_us,
+                read_us, pub_us, recv_us, stored_us)
+               VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s)""", sensor)
+        cursor.executemany(
+            "INSERT INTO led_status (led1, led2, timestamp) VALUES (%s, %s, %s)", led)
+        conn.commit()
+    cursor.close()
+
+
+def run_migration(conn):
+    with open(MIGRATION, encoding="utf-8") as f:
+        lines = [l for l in f if not l.lstrip().startswith("--")]
+    cursor = conn.cursor()
+    for statement in "".join(lines).split(";"):
+        statement = statement.strip()
+        if statement and not statement.upper().startswith("USE "):
+            cursor.execute(statement)
+    conn.commit()
+    cursor.close()
+
+
+def time_queries(conn, queries, repeat, timeout_s):
+    cursor = conn.cursor()
+    # Giới hạn thời gian mỗi câu (MySQL); truy vấn cũ có thể chạy rất lâu
+    try:
+        cursor.execute(f"SET SESSION max_execution_time = {int(timeout_s * 1000)}")
+    except mysql.connector.Error:
+        pass
+    results = {}
+    for name, sql in queries.items():
+        samples = []
+        for _ in range(repeat):
+            start = time.perf_counter()
+            try:
+                cursor.execute(sql)
+                cursor.fetchall()
+            except mysql.connector.Error as e:
+                print(f"  {name}: {e.msg}")
+                samples = None
+                break
+            samples.append((time.perf_counter() - start) * 1000)
+        results[name] = statistics.median(samples) if samples else None
+    cursor.close()
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--rows", type=int, default=1000000)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--timeout", type=float, default=60.0,
+                        help="giây tối đa cho mỗi truy vấn")
+    parser.add_argument("--database", default="sensor_system_bench")
+    args = parser.parse_args()
+
+    conn = mysql.connector.connect(**BASE_CONFIG)
+    cursor = conn.cursor()
+    cursor.execute(f"DROP DATABASE IF EXISTS `{args.database}`")
+    cursor.execute(f"CREATE DATABASE `{args.database}`")
+    cursor.execute(f"USE `{args.database}`")
+    for ddl in SCHEMA:
+        cursor.execute(ddl)
+    cursor.close()
+
+    populate(conn, args.rows)
+    before = time_queries(conn, OLD_QUERIES, args.repeat, args.timeout)
+    print("Chạy migrations/002_latest_state.sql...")
+    run_migration(conn)
+    after = time_queries(conn, NEW_QUERIES, args.repeat, args.timeout)
+    conn.close()
+
+    def fmt(v):
+        return f"{v:12.3f}" if v is not None else f"{'timeout':>12}"
+
+    print(f"\nrows={args.rows}, median of {args.repeat} (ms)")
+    print(f"  {'query':<16}{'before':>12}{'after':>12}")
+    for name in OLD_QUERIES:
+        print(f"  {name:<16}{fmt(before[name])}{fmt(after[name])}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,78 @@
+import itertools
+import json
+import queue
+import threading
+
+
+class Broadcaster:
+    """
+    Phát sự kiện Server-Sent Events tới mọi client đang mở /api/stream.
+    Mỗi sự kiện được định dạng một lần rồi đưa vào hàng đợi riêng của từng
+    client; client đọc chậm bị bỏ sự kiện cũ nhất thay vì làm nghẽn MQTT.
+    """
+
+    def __init__(self, max_clients=100, queue_size=32):
+        self.max_clients = max_clients
+        self.queue_size = queue_size
+        self._lock = threading.Lock()
+        self._clients = {}        # Hàng đợi -> thiết bị client theo dõi (None: tất cả)
+        self._ids = itertools.count(1)
+        self._published = 0
+        self._dropped = 0
+        self._rejected = 0
+
+    def subscribe(self, device=None):
+        """
+        Hàng đợi sự kiện cho một client mới, None nếu đã đủ max_clients.
+        Có device thì client chỉ nhận sự kiện của thiết bị đó.
+        """
+        q = queue.Queue(maxsize=self.queue_size)
+        with self._lock:
+            if len(self._clients) >= self.max_clients:
+                self._rejected += 1
+                return None
+            self._clients[q] = device
+        return q
+
+    def unsubscribe(self, q):
+        with self._lock:
+            self._clients.pop(q, None)
+
+    @staticmethod
+    def format(event, data, event_id=None):
+        lines = []
+        if event_id is not None:
+            lines.append(f"id: {event_id}")
+        lines.append(f"event: {event}")
+        lines.append(f"data: {json.dumps(data)}")
+        return "\n".join(lines) + "\n\n"
+
+    def publish(self, event, data, device=None):
+        """device: thiết bị của sự kiện, None thì gửi cho mọi client."""
+        with self._lock:
+            message = self.format(event, data, next(self._ids))
+            self._published += 1
+            clients = [q for q, want in self._clients.items()
+                       if device is None or want is None or want == device]
+        for q in clients:
+            while True:
+                try:
+                    q.put_nowait(message)
+                    break
+                except queue.Full:
+                    try:
+                        q.get_nowait()
+                        with self._lock:
+                            self._dropped += 1
+                    except queue.Empty:
+                        pass
+
+    def metrics(self):
+        with self._lock:
+            return {
+                "clients": len(self._clients),
+                "max_clients": self.max_clients,
+                "published": self._published,
+                "dropped": self._dropped,
+                "rejected": self._rejected,
+            }
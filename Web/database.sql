@@ -1,19 +1,84 @@
 USE sensor_system;
 /*CREATE TABLE sensor_data (
-    id INT AUTO_INCREMENT PRIMARY KEY,
+    id INT AUTO_INCREMENT,
     temperature FLOAT NOT NULL,
     humidity FLOAT NOT NULL,
     lux FLOAT NOT NULL,
-    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
+    timestamp DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    -- Trace độ trễ (migrations/001_latency_trace.sql)
+    bh1750_seq INT UNSIGNED NULL,
+    bh1750_acq_us BIGINT NULL,
+    dht11_seq INT UNSIGNED NULL,
+    dht11_acq_us BIGINT NULL,
+    read_us BIGINT NULL,
+    pub_us BIGINT NULL,
+    recv_us BIGINT NULL,
+    stored_us BIGINT NULL,
+    -- migrations/002_latest_state.sql
+    INDEX idx_sensor_timestamp (timestamp),
+    -- migrations/003_rollups_partitions.sql: partition theo ngày, retention.py tạo/xóa
+    PRIMARY KEY (id, timestamp)
 );*/
 /*CREATE TABLE led_status (
-    id INT AUTO_INCREMENT PRIMARY KEY,
+    id INT AUTO_INCREMENT,
     led1 VARCHAR(3) NOT NULL,  -- Giá trị: 'ON' hoặc 'OFF'
     led2 VARCHAR(3) NOT NULL,  -- Giá trị: 'ON' hoặc 'OFF'
-    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP
+    timestamp DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    INDEX idx_led_timestamp (timestamp),
+    PRIMARY KEY (id, timestamp)
+);*/
+/*-- Partition theo ngày cho hai bảng trên: p_start chứa tới hết ngày tạo bảng,
+-- retention.py tách p_future từ ngày mai. Ranh giới phải là hằng số nên dùng
+-- câu lệnh động như migrations/003_rollups_partitions.sql
+SET @p_start = TO_DAYS(CURDATE() + INTERVAL 1 DAY);
+SET @sql = CONCAT('ALTER TABLE sensor_data PARTITION BY RANGE (TO_DAYS(timestamp)) (',
+                  'PARTITION p_start VALUES LESS THAN (', @p_start, '), ',
+                  'PARTITION p_future VALUES LESS THAN MAXVALUE)');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+SET @sql = REPLACE(@sql, 'sensor_data', 'led_status');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;*/
+/*-- Rollup theo phút/giờ, backend cộng dồn mỗi lần flush (migrations/003_rollups_partitions.sql)
+CREATE TABLE sensor_rollup_1m (
+    bucket DATETIME NOT NULL PRIMARY KEY,
+    samples INT UNSIGNED NOT NULL,
+    temperature_sum DOUBLE NOT NULL,
+    temperature_min FLOAT NOT NULL,
+    temperature_max FLOAT NOT NULL,
+    humidity_sum DOUBLE NOT NULL,
+    humidity_min FLOAT NOT NULL,
+    humidity_max FLOAT NOT NULL,
+    lux_sum DOUBLE NOT NULL,
+    lux_min FLOAT NOT NULL,
+    lux_max FLOAT NOT NULL
+);
+CREATE TABLE sensor_rollup_1h LIKE sensor_rollup_1m;*/
+/*-- Bản ghi mới nhất của từng thiết bị cho /api/latest (migrations/002_latest_state.sql)
+CREATE TABLE latest_state (
+    device VARCHAR(32) NOT NULL PRIMARY KEY,
+    temperature FLOAT NULL,
+    humidity FLOAT NULL,
+    lux FLOAT NULL,
+    timestamp DATETIME NULL,
+    bh1750_seq INT UNSIGNED NULL,
+    bh1750_acq_us BIGINT NULL,
+    dht11_seq INT UNSIGNED NULL,
+    dht11_acq_us BIGINT NULL,
+    read_us BIGINT NULL,
+    pub_us BIGINT NULL,
+    recv_us BIGINT NULL,
+    stored_us BIGINT NULL,
+    led1 VARCHAR(3) NOT NULL DEFAULT 'OFF',
+    led2 VARCHAR(3) NOT NULL DEFAULT 'OFF',
+    led_timestamp DATETIME NULL
 );*/
 /*-- Xóa và reset AUTO_INCREMENT
 TRUNCATE TABLE sensor_data;
-TRUNCATE TABLE led_status;*/
+TRUNCATE TABLE led_status;
+TRUNCATE TABLE latest_state;
+TRUNCATE TABLE sensor_rollup_1m;
+TRUNCATE TABLE sensor_rollup_1h;*/
 SELECT * FROM led_status;
 SELECT * FROM sensor_data;
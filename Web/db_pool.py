@@ -0,0 +1,205 @@
+import threading
+import time
+from contextlib import contextmanager
+
+import mysql.connector
+
+# Ngưỡng (ms) của histogram thời gian chờ lấy kết nối
+WAIT_BUCKETS_MS = (1, 5, 10, 50, 100, 500, 1000)
+
+
+class PoolTimeout(Exception):
+    """Không lấy được kết nối trong thời gian cho phép (pool đã dùng hết)."""
+
+
+class PooledConnection:
+    """Một kết nối MySQL của pool, giữ sẵn prepared statement cho từng câu SQL cố định."""
+
+    def __init__(self, config):
+        # autocommit: kết nối dùng lại không giữ snapshot cũ của transaction trước;
+        # nhiều câu ghi cần nguyên tử thì bọc trong begin()/commit()
+        self.conn = mysql.connector.connect(autocommit=True, **config)
+        self.statements = {}
+        self.last_used = time.monotonic()
+
+    def _prepared(self, sql):
+        # Mỗi câu SQL một cursor prepared riêng: MySQL chỉ PREPARE lần đầu,
+        # các lần sau chỉ gửi tham số
+        cursor = self.statements.get(sql)
+        if cursor is None:
+            cursor = self.conn.cursor(prepared=True)
+            self.statements[sql] = cursor
+        return cursor
+
+    def execute(self, sql, params=()):
+        cursor = self._prepared(sql)
+        cursor.execute(sql, params)
+        return cursor
+
+    def query(self, sql, params=()):
+        cursor = self.execute(sql, params)
+        columns = cursor.column_names
+        return [dict(zip(columns, row)) for row in cursor.fetchall()]
+
+    def query_one(self, sql, params=()):
+        rows = self.query(sql, params)
+        return rows[0] if rows else None
+
+    def cursor(self, **kwargs):
+        """Cursor thường cho câu SQL dựng động (executemany, IN (...))."""
+        return self.conn.cursor(**kwargs)
+
+    def begin(self):
+        self.conn.start_transaction()
+
+    def commit(self):
+        self.conn.commit()
+
+    def rollback(self):
+        try:
+            self.conn.rollback()
+        except mysql.connector.Error:
+            pass
+
+    def close(self):
+        for cursor in self.statements.values():
+            try:
+                cursor.close()
+            except mysql.connector.Error:
+                pass
+        self.statements.clear()
+        try:
+            self.conn.close()
+        except mysql.connector.Error:
+            pass
+
+
+class DBPool:
+    """
+    Pool kết nối có giới hạn. Kết nối được mở khi cần, tối đa `size` cái;
+    khi đã dùng hết, người gọi chờ tối đa `timeout` giây rồi nhận PoolTimeout.
+    Kết nối lỗi bị bỏ đi, kết nối nằm yên lâu hơn `recycle` giây được ping
+    lại trước khi dùng.
+    """
+
+    def __init__(self, config, size=8, timeout=5.0, recycle=300):
+        self.config = config
+        self.size = size
+        self.timeout = timeout
+        self.recycle = recycle
+        self._slots = threading.BoundedSemaphore(size)
+        self._lock = threading.Lock()
+        self._idle = []          # LIFO: kết nối vừa dùng còn "nóng"
+        self._started = time.monotonic()
+        self._in_use = 0
+        self._busy_since = self._started
+        self._busy_conn_s = 0.0  # Tích phân số kết nối đang dùng theo thời gian
+        self._created = 0
+        self._discarded = 0
+        self._acquired = 0
+        self._timeouts = 0
+        self._wait_s = 0.0
+        self._wait_max_s = 0.0
+        self._wait_hist = [0] * (len(WAIT_BUCKETS_MS) + 1)
+
+    def _account_busy(self, now):
+        # Gọi với _lock: cộng dồn thời gian * số kết nối đang bận
+        self._busy_conn_s += self._in_use * (now - self._busy_since)
+        self._busy_since = now
+
+    def _record_wait(self, waited):
+        self._acquired += 1
+        self._wait_s += waited
+        self._wait_max_s = max(self._wait_max_s, waited)
+        waited_ms = waited * 1000
+        for i, limit in enumerate(WAIT_BUCKETS_MS):
+            if waited_ms <= limit:
+                self._wait_hist[i] += 1
+                break
+        else:
+            self._wait_hist[-1] += 1
+
+    def _take(self):
+        while True:
+            with self._lock:
+                pooled = self._idle.pop() if self._idle else None
+            if pooled is None:
+                pooled = PooledConnection(self.config)
+                with self._lock:
+                    self._created += 1
+                return pooled
+            if time.monotonic() - pooled.last_used < self.recycle:
+                return pooled
+            try:
+                pooled.conn.ping(reconnect=False)
+                return pooled
+            except mysql.connector.Error:
+                pooled.close()
+                with self._lock:
+                    self._discarded += 1
+
+    @contextmanager
+    def connection(self):
+        start = time.monotonic()
+        if not self._slots.acquire(timeout=self.timeout):
+            with self._lock:
+                self._timeouts += 1
+            raise PoolTimeout(f"no database connection free after {self.timeout}s")
+        try:
+            pooled = self._take()
+        except Exception:
+            self._slots.release()
+            raise
+        now = time.monotonic()
+        with self._lock:
+            self._record_wait(now - start)
+            self._account_busy(now)
+            self._in_use += 1
+
+        broken = False
+        try:
+            yield pooled
+        except mysql.connector.Error:
+            broken = True
+            raise
+        finally:
+            if not broken and pooled.conn.in_transaction:
+                pooled.rollback()
+            now = time.monotonic()
+            pooled.last_used = now
+            with self._lock:
+                self._account_busy(now)
+                self._in_use -= 1
+                if broken:
+                    self._discarded += 1
+                else:
+                    self._idle.append(pooled)
+            if broken:
+                pooled.close()
+            self._slots.release()
+
+    def metrics(self):
+        now = time.monotonic()
+        with self._lock:
+            self._account_busy(now)
+            uptime = now - self._started
+            acquired = self._acquired
+            return {
+                "size": self.size,
+                "open": len(self._idle) + self._in_use,
+                "in_use": self._in_use,
+                "idle": len(self._idle),
+                "created": self._created,
+                "discarded": self._discarded,
+                "acquired": acquired,
+                "timeouts": self._timeouts,
+                "wait_ms_avg": round(self._wait_s * 1000 / acquired, 3) if acquired else 0.0,
+                "wait_ms_max": round(self._wait_max_s * 1000, 3),
+                "wait_ms_hist": {
+                    **{f"le_{limit}": n for limit, n in zip(WAIT_BUCKETS_MS, self._wait_hist)},
+                    "inf": self._wait_hist[-1],
+                },
+                # Tỉ lệ dung lượng pool đã dùng, trung bình từ lúc khởi động
+                "utilization": round(self._busy_conn_s / (self.size * uptime), 4) if uptime else 0.0,
+                "uptime_s": round(uptime, 1),
+            }
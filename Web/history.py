@@ -0,0 +1,162 @@
+import math
+from datetime import datetime, timedelta
+
+DEFAULT_SPAN = timedelta(hours=24)
+DEFAULT_MAX_POINTS = 500
+MAX_POINTS_LIMIT = 5000    # Trần số điểm/dòng mỗi phản hồi, bất kể khoảng thời gian
+LTTB_OVERSAMPLE = 4        # LTTB chọn từ max_points * 4 bucket trung bình
+TIME_FORMAT = '%Y-%m-%d %H:%M:%S'
+
+
+def parse_time(value):
+    """
+    Nhận 'YYYY-MM-DD HH:MM[:SS]', 'YYYY-MM-DDTHH:MM[:SS]' hoặc epoch giây.
+    Có múi giờ (Z, +07:00) thì đổi về giờ địa phương không múi giờ như cột timestamp.
+    """
+    try:
+        return datetime.fromtimestamp(float(value))
+    except (ValueError, OverflowError, OSError):
+        pass
+    try:
+        # fromisoformat trước Python 3.11 không nhận hậu tố Z
+        iso = value[:-1] + "+00:00" if value.endswith(("Z", "z")) else value
+        parsed = datetime.fromisoformat(iso)
+        if parsed.tzinfo is not None:
+            parsed = parsed.astimezone().replace(tzinfo=None)
+        return parsed
+    except (ValueError, OverflowError, OSError):
+        raise ValueError(f"invalid time: {value!r}")
+
+
+def parse_range(args):
+    """from/to/max_points từ query string; mặc định 24 giờ gần nhất."""
+    end = parse_time(args["to"]) if args.get("to") else datetime.now()
+    start = parse_time(args["from"]) if args.get("from") else end - DEFAULT_SPAN
+    if start >= end:
+        raise ValueError("from must be before to")
+    try:
+        max_points = int(args.get("max_points", DEFAULT_MAX_POINTS))
+    except ValueError:
+        raise ValueError("max_points must be an integer")
+    if max_points < 2:
+        raise ValueError("max_points must be at least 2")
+    return start, end, min(max_points, MAX_POINTS_LIMIT)
+
+
+def bucket_seconds(start, end, buckets):
+    """Độ rộng bucket (giây, nguyên) để chia [start, end) thành tối đa `buckets` phần."""
+    return max(1, math.ceil((end - start).total_seconds() / buckets))
+
+
+def encode_cursor(row):
+    return f"{row['timestamp'].strftime('%Y-%m-%dT%H:%M:%S')}_{row['id']}"
+
+
+def decode_cursor(cursor):
+    """Cursor keyset (timestamp, id) của dòng cuối trang trước."""
+    try:
+        ts, row_id = cursor.rsplit("_", 1)
+        return datetime.fromisoformat(ts), int(row_id)
+    except ValueError:
+        raise ValueError(f"invalid cursor: {cursor!r}")
+
+
+def lttb(points, threshold):
+    """
+    Largest-Triangle-Three-Buckets: giữ `threshold` điểm (x, y) giữ được hình
+    dạng đường cong. Điểm đầu/cuối luôn được giữ.
+    """
+    n = len(points)
+    if threshold >= n or threshold < 3:
+        return list(points)
+
+    sampled = [points[0]]
+    every = (n - 2) / (threshold - 2)
+    a = 0
+    for i in range(threshold - 2):
+        # Trung bình của bucket kế tiếp làm đỉnh thứ ba của tam giác
+        next_start = int((i + 1) * every) + 1
+        next_end = min(int((i + 2) * every) + 1, n)
+        span = points[next_start:next_end] or points[-1:]
+        avg_x = sum(p[0] for p in span) / len(span)
+        avg_y = sum(p[1] for p in span) / len(span)
+
+        start = int(i * every) + 1
+        end = int((i + 1) * every) + 1
+        ax, ay = points[a]
+        best, best_area = start, -1.0
+        for j in range(start, end):
+            x, y = points[j]
+            area = abs((ax - avg_x) * (y - ay) - (ax - x) * (avg_y - ay))
+            if area > best_area:
+                best, best_area = j, area
+        sampled.append(points[best])
+        a = best
+    sampled.append(points[-1])
+    return sampled
+
+
+# Nguồn cho mode minmax/lttb, từ mịn tới thô: (tên, bảng, độ rộng bucket gốc giây)
+SOURCES = (
+    ("raw", "sensor_data", 1),
+    ("rollup_1m", "sensor_rollup_1m", 60),
+    ("rollup_1h", "sensor_rollup_1h", 3600),
+)
+
+RAW_BUCKET_SQL = """
+    SELECT FLOOR((UNIX_TIMESTAMP(timestamp) - %s) / %s) AS bucket_no,
+           MIN(timestamp) AS timestamp, COUNT(*) AS count,
+           AVG(temperature) AS temperature_avg,
+           MIN(temperature) AS temperature_min, MAX(temperature) AS temperature_max,
+           AVG(humidity) AS humidity_avg,
+           MIN(humidity) AS humidity_min, MAX(humidity) AS humidity_max,
+           AVG(lux) AS lux_avg, MIN(lux) AS lux_min, MAX(lux) AS lux_max
+    FROM sensor_data
+    WHERE timestamp >= %s AND timestamp < %s
+    GROUP BY bucket_no
+    ORDER BY bucket_no
+"""
+
+ROLLUP_BUCKET_SQL = """
+    SELECT FLOOR((UNIX_TIMESTAMP(bucket) - %s) / %s) AS bucket_no,
+           MIN(bucket) AS timestamp, SUM(samples) AS count,
+           SUM(temperature_sum) / SUM(samples) AS temperature_avg,
+           MIN(temperature_min) AS temperature_min, MAX(temperature_max) AS temperature_max,
+           SUM(humidity_sum) / SUM(samples) AS humidity_avg,
+           MIN(humidity_min) AS humidity_min, MAX(humidity_max) AS humidity_max,
+           SUM(lux_sum) / SUM(samples) AS lux_avg,
+           MIN(lux_min) AS lux_min, MAX(lux_max) AS lux_max
+    FROM {table}
+    WHERE bucket >= %s AND bucket < %s
+    GROUP BY bucket_no
+    ORDER BY bucket_no
+"""
+
+
+def pick_source(bucket_s, start, now, keep_days):
+    """
+    Nguồn thô nhất mà bucket gốc vẫn không lớn hơn bucket_s, và còn giữ dữ
+    liệu tại `start` (keep_days: {tên nguồn: số ngày giữ}, None = vĩnh viễn).
+    Trả về (tên, SQL, độ rộng bucket gốc).
+    """
+    chosen = SOURCES[0]
+    for source in SOURCES:
+        name, _, width = source
+        if width <= bucket_s:
+            chosen = source
+    # Khoảng thời gian đã quá hạn giữ của nguồn mịn: chuyển sang nguồn thô hơn
+    for source in SOURCES[SOURCES.index(chosen):]:
+        days = keep_days.get(source[0])
+        chosen = source
+        if days is None or start >= now - timedelta(days=days):
+            break
+    name, table, width = chosen
+    sql = RAW_BUCKET_SQL if name == "raw" else ROLLUP_BUCKET_SQL.format(table=table)
+    return name, sql, width
+
+
+def align(start, bucket_s, width):
+    """Làm tròn bucket_s lên bội số của width và start xuống biên width."""
+    bucket_s = math.ceil(bucket_s / width) * width
+    epoch = int(start.timestamp())
+    return bucket_s, epoch - epoch % width
@@ -4,6 +4,14 @@ const lightEl = document.getElementById('light');
 const led1El = document.getElementById('led1-status');
 const led2El = document.getElementById('led2-status');
 const led1ToggleBtn = document.getElementById('led1-toggle-btn');
+const latencyEl = document.getElementById('latency');
+
+const API_BASE = 'http://localhost:5000';
+
+// Nếu seq không đổi quá lâu thì một chặng nào đó đang bị kẹt
+const STALL_AFTER_MS = 15000;
+// Chỉ dùng khi trình duyệt không có EventSource
+const POLL_INTERVAL_MS = 5000;
 
 const chart = new Chart(document.getElementById('sensorChart'), {
   type: 'line',
@@ -87,80 +95,120 @@ const chart = new Chart(document.getElementById('sensorChart'), {
 });
 
 let led1UserStatus = null;
-let lastLed2Status = null;
-
-async function fetchSensorData() {
-  try {
-    const res = await fetch('http://localhost:5000/api/latest');
-    const data = await res.json();
-    if (data.error) return;
+let lastData = null;
+let lastChartSeq = null;
+let lastSeq = null;
+let lastSeqChange = Date.now();
+
+function renderLatency(data) {
+  const trace = data.trace;
+  if (!trace) return;
+
+  const displayUs = data.displayed_us ?? Date.now() * 1000;
+  const latency = { ...trace.latency_ms };
+  latency.served_to_display = (displayUs - trace.stamps_us.served_us) / 1000;
+  if (trace.stamps_us.bh1750_acq_us) {
+    latency.total = (displayUs - trace.stamps_us.bh1750_acq_us) / 1000;
+  }
 
-    const time = new Date().toLocaleTimeString();
-    const temperature = parseInt(data.temperature);
-    const humidity = parseInt(data.humidity);
-    const lux = parseInt(data.lux);
+  if (data.seq !== lastSeq) {
+    lastSeq = data.seq;
+    lastSeqChange = Date.now();
+  }
+  // Backend báo stale khi thiết bị im lặng quá lâu
+  const stalled = data.stale || Date.now() - lastSeqChange > STALL_AFTER_MS;
 
-    tempEl.textContent = isNaN(temperature) ? '-- °C' : `${temperature} °C`;
-    humEl.textContent = isNaN(humidity) ? '-- %' : `${humidity} %`;
-    lightEl.textContent = isNaN(lux) ? '-- lux' : `${lux} lux`;
+  const parts = Object.entries(latency).map(([hop, ms]) => `${hop}: ${ms.toFixed(1)} ms`);
+  const source = data.device ? `${data.device}, ` : '';
+  latencyEl.textContent = `Latency (${source}seq ${data.seq ?? '--'})${stalled ? ' [STALLED]' : ''} — ${parts.join(', ')}`;
+  latencyEl.classList.toggle('stalled', stalled);
+}
 
-    if (led1UserStatus === null) {
-      led1El.textContent = data.led1 || "OFF";
-    } else {
-      led1El.textContent = led1UserStatus;
-    }
+function renderSensorData(data) {
+  lastData = data;
+  data.displayed_us = Date.now() * 1000;
+  const time = new Date().toLocaleTimeString();
+  const temperature = parseInt(data.temperature);
+  const humidity = parseInt(data.humidity);
+  const lux = parseInt(data.lux);
+
+  tempEl.textContent = isNaN(temperature) ? '-- °C' : `${temperature} °C`;
+  humEl.textContent = isNaN(humidity) ? '-- %' : `${humidity} %`;
+  lightEl.textContent = isNaN(lux) ? '-- lux' : `${lux} lux`;
+  renderLatency(data);
+
+  if (led1UserStatus === null) {
+    led1El.textContent = data.led1 || "OFF";
+  } else {
+    led1El.textContent = led1UserStatus;
+  }
 
-    const led2Current = data.led2 || "OFF";
-        const alertSound = document.getElementById('alert-sound');
-
-        if (led2Current === "ON") {
-        led2El.innerHTML = '<span class="blink-scale">⚠️</span>';
-        led2El.style.color = "red";
-
-        // Phát âm thanh cảnh báo
-        alertSound.play().catch(e => {
-            // Bỏ qua lỗi nếu trình duyệt chặn autoplay
-            console.warn("Không thể phát âm thanh:", e);
-        });
-        } else {
-        led2El.textContent = "OFF";
-        led2El.style.color = "#111";
-        alertSound.pause();
-        alertSound.currentTime = 0;
-        }
+  const led2Current = data.led2 || "OFF";
+      const alertSound = document.getElementById('alert-sound');
 
+      if (led2Current === "ON") {
+      led2El.innerHTML = '<span class="blink-scale">⚠️</span>';
+      led2El.style.color = "red";
 
-    if (led2Current !== lastLed2Status) {
-      lastLed2Status = led2Current;
-      await fetch('http://localhost:5000/api/log_led2', {
-        method: 'POST',
-        headers: { 'Content-Type': 'application/json' },
-        body: JSON.stringify({ led2: led2Current })
+      // Phát âm thanh cảnh báo
+      alertSound.play().catch(e => {
+          // Bỏ qua lỗi nếu trình duyệt chặn autoplay
+          console.warn("Không thể phát âm thanh:", e);
       });
-    }
+      } else {
+      led2El.textContent = "OFF";
+      led2El.style.color = "#111";
+      alertSound.pause();
+      alertSound.currentTime = 0;
+      }
 
-    if (chart.data.labels.length > 10) {
-      chart.data.labels.shift();
-      chart.data.datasets.forEach(ds => ds.data.shift());
-    }
 
-    chart.data.labels.push(time);
-    chart.data.datasets[0].data.push(temperature);
-    chart.data.datasets[1].data.push(humidity);
-    chart.data.datasets[2].data.push(lux);
-    chart.update();
+  // Sự kiện LED mang lại mẫu cũ: chỉ thêm điểm khi có mẫu mới
+  if (data.seq != null && data.seq === lastChartSeq) return;
+  lastChartSeq = data.seq;
+
+  if (chart.data.labels.length > 10) {
+    chart.data.labels.shift();
+    chart.data.datasets.forEach(ds => ds.data.shift());
+  }
+
+  chart.data.labels.push(time);
+  chart.data.datasets[0].data.push(temperature);
+  chart.data.datasets[1].data.push(humidity);
+  chart.data.datasets[2].data.push(lux);
+  chart.update();
+}
 
+async function fetchSensorData() {
+  try {
+    const res = await fetch(`${API_BASE}/api/latest`);
+    const data = await res.json();
+    if (data.error) return;
+    renderSensorData(data);
   } catch (err) {
     console.error("Fetch failed:", err);
   }
 }
 
+// Backend đẩy sự kiện "latest" khi có bản tin mới hoặc LED đổi trạng thái;
+// EventSource tự kết nối lại khi mất kết nối
+function subscribeSensorData() {
+  if (!window.EventSource) {
+    fetchSensorData();
+    setInterval(fetchSensorData, POLL_INTERVAL_MS);
+    return;
+  }
+  const source = new EventSource(`${API_BASE}/api/stream`);
+  source.addEventListener('latest', (e) => renderSensorData(JSON.parse(e.data)));
+  source.onerror = () => console.warn("Stream disconnected, retrying...");
+}
+
 async function toggleLed1() {
   try {
     const currentStatus = led1El.textContent.trim();
     const newStatus = currentStatus === "ON" ? "OFF" : "ON";
 
-    const res = await fetch('http://localhost:5000/api/led', {
+    const res = await fetch(`${API_BASE}/api/led`, {
       method: 'POST',
       headers: { 'Content-Type': 'application/json' },
       body: JSON.stringify({ led1: newStatus })
@@ -180,5 +228,6 @@ async function toggleLed1() {
 }
 
 led1ToggleBtn.addEventListener('click', toggleLed1);
-fetchSensorData();
-setInterval(fetchSensorData, 1000);
+subscribeSensorData();
+// Không có sự kiện mới thì vẫn cập nhật trạng thái STALLED
+setInterval(() => { if (lastData) renderLatency(lastData); }, 1000);
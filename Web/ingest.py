@@ -0,0 +1,376 @@
+import collections
+import json
+import os
+import threading
+import time
+from datetime import datetime
+
+from mysql.connector import errors as mysql_errors
+
+from db_pool import PoolTimeout
+
+# timestamp do backend điền từ recv_us của từng bản ghi, cùng giá trị dùng chọn bucket rollup
+SENSOR_INSERT = """INSERT INTO sensor_data
+   (temperature, humidity, lux,
+    bh1750_seq, bh1750_acq_us, dht11_seq, dht11_acq_us,
+    read_us, pub_us, recv_us, stored_us, timestamp)
+   VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s)"""
+LED_INSERT = "INSERT INTO led_status (led1, led2, timestamp) VALUES (%s, %s, %s)"
+# stored_us chỉ biết sau khi commit: điền bằng UPDATE theo dải id của lô.
+# Một INSERT nhiều dòng nhận id liên tiếp; điều kiện timestamp để chỉ quét
+# partition của lô.
+STORED_UPDATE = """UPDATE sensor_data SET stored_us = %s
+   WHERE id BETWEEN %s AND %s AND timestamp BETWEEN %s AND %s AND stored_us IS NULL"""
+# Bản ghi cuối của mỗi lô được chép vào latest_state (migrations/002_latest_state.sql)
+LATEST_UPSERT = """INSERT INTO latest_state
+   (device, temperature, humidity, lux,
+    bh1750_seq, bh1750_acq_us, dht11_seq, dht11_acq_us,
+    read_us, pub_us, recv_us, stored_us, timestamp, led1, led2, led_timestamp)
+   VALUES (%s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, %s, NOW())
+   ON DUPLICATE KEY UPDATE
+    temperature = VALUES(temperature), humidity = VALUES(humidity), lux = VALUES(lux),
+    timestamp = VALUES(timestamp),
+    bh1750_seq = VALUES(bh1750_seq), bh1750_acq_us = VALUES(bh1750_acq_us),
+    dht11_seq = VALUES(dht11_seq), dht11_acq_us = VALUES(dht11_acq_us),
+    read_us = VALUES(read_us), pub_us = VALUES(pub_us),
+    recv_us = VALUES(recv_us), stored_us = VALUES(stored_us),
+    led1 = VALUES(led1), led2 = VALUES(led2), led_timestamp = VALUES(led_timestamp)"""
+DEFAULT_DEVICE = "default"
+
+# Rollup min/max/tổng theo phút và theo giờ (migrations/003_rollups_partitions.sql),
+# cộng dồn mỗi lần flush nên không cần quét lại sensor_data
+ROLLUP_FIELDS = ("temperature", "humidity", "lux")
+ROLLUPS = {"sensor_rollup_1m": 60, "sensor_rollup_1h": 3600}
+
+
+def rollup_upsert(table):
+    stats = [f"{f}_{s}" for f in ROLLUP_FIELDS for s in ("sum", "min", "max")]
+    updates = ["samples = samples + VALUES(samples)"]
+    for f in ROLLUP_FIELDS:
+        updates.append(f"{f}_sum = {f}_sum + VALUES({f}_sum)")
+        updates.append(f"{f}_min = LEAST({f}_min, VALUES({f}_min))")
+        updates.append(f"{f}_max = GREATEST({f}_max, VALUES({f}_max))")
+    return (f"INSERT INTO {table} (bucket, samples, {', '.join(stats)})\n"
+            f"   VALUES ({', '.join(['%s'] * (len(stats) + 2))})\n"
+            f"   ON DUPLICATE KEY UPDATE {', '.join(updates)}")
+
+
+ROLLUP_UPSERTS = {table: rollup_upsert(table) for table in ROLLUPS}
+
+
+def rollup_row(bucket, rows):
+    """rows: các sensor_row rơi vào cùng bucket."""
+    row = [bucket, len(rows)]
+    for i, _ in enumerate(ROLLUP_FIELDS):
+        values = [float(s[i]) for s in rows]
+        row += [sum(values), min(values), max(values)]
+    return tuple(row)
+
+
+def row_time(sensor_row, fallback):
+    """Thời điểm backend nhận bản tin (recv_us), không phải lúc flush/replay."""
+    recv_us = sensor_row[9]
+    return datetime.fromtimestamp(recv_us // 1_000_000) if recv_us else fallback
+
+
+def rollup_rows(width, batch, times):
+    """Một dòng upsert cho mỗi bucket mà lô chạm tới."""
+    buckets = {}
+    for (s, _, _), ts in zip(batch, times):
+        epoch = int(ts.timestamp())
+        buckets.setdefault(datetime.fromtimestamp(epoch - epoch % width), []).append(s)
+    return [rollup_row(bucket, rows) for bucket, rows in sorted(buckets.items())]
+
+OVERFLOW_POLICIES = ("block", "drop", "spool")
+# Chỉ các lỗi này được coi là CSDL tạm thời không ghi được (thử lại/spool);
+# lỗi khác là do dữ liệu của lô và thử lại không bao giờ thành công
+TRANSIENT_ERRORS = (mysql_errors.OperationalError, mysql_errors.InterfaceError, PoolTimeout)
+RATE_WINDOW_S = 60        # Cửa sổ tính rows/s gần đây
+
+
+def now_us():
+    return int(time.time() * 1_000_000)
+
+
+class IngestBuffer:
+    """
+    Gom các bản ghi MQTT rồi ghi theo lô: mỗi lần flush là một transaction với
+    hai executemany (connector gộp thành INSERT ... VALUES (...),(...)).
+    Flush khi đủ `batch_size` bản ghi hoặc sau `flush_interval` giây.
+
+    Hàng đợi giới hạn `max_queue` bản ghi; khi đầy thì theo `overflow`:
+      - "block": người gọi chờ tối đa `block_timeout` giây rồi bỏ bản ghi
+      - "drop":  bỏ ngay bản ghi mới
+      - "spool": ghi bản ghi ra `spool_path` (JSON lines, fsync)
+    Có `spool_path` thì lô ghi CSDL lỗi cũng được đổ ra file thay vì giữ trong
+    RAM, và file được nạp lại vào CSDL khi kết nối trở lại.
+
+    Lô lỗi vì dữ liệu (không phải mất kết nối) được chia đôi dần để tách bản
+    ghi hỏng; bản ghi đó bị bỏ (ghi vào `spool_path`.rejected nếu có spool).
+
+    `on_stored(device, recv_us, stored_us)` được gọi sau commit cho bản ghi
+    cuối của từng thiết bị trong lô.
+    """
+
+    def __init__(self, pool, batch_size=200, flush_interval=0.5, max_queue=10000,
+                 overflow="block", block_timeout=1.0, spool_path=None, on_stored=None):
+        if overflow not in OVERFLOW_POLICIES:
+            raise ValueError(f"overflow must be one of {OVERFLOW_POLICIES}")
+        if overflow == "spool" and not spool_path:
+            raise ValueError("overflow='spool' needs spool_path")
+        self.pool = pool
+        self.batch_size = batch_size
+        self.flush_interval = flush_interval
+        self.max_queue = max_queue
+        self.overflow = overflow
+        self.block_timeout = block_timeout
+        self.spool_path = spool_path
+        self.on_stored = on_stored
+        self._queue = collections.deque()
+        self._cond = threading.Condition()
+        self._spool_lock = threading.Lock()
+        self._retry = None       # Lô ghi lỗi đang chờ thử lại (khi không có spool)
+        self._stopping = False
+        self._thread = None
+        self._started = time.monotonic()
+        self._recent = collections.deque()   # (thời điểm, số dòng) của từng lô
+        self._enqueued = 0
+        self._dropped = 0
+        self._spooled = 0
+        self._replayed = 0
+        self._rejected = 0
+        self._flushed_rows = 0
+        self._batches = 0
+        self._errors = 0
+        self._last_error = None
+        self._flush_s = 0.0
+        self._flush_max_s = 0.0
+
+    def start(self):
+        self._thread = threading.Thread(target=self._run, name="ingest-flush", daemon=True)
+        self._thread.start()
+
+    def put(self, sensor_row, led_row, device=DEFAULT_DEVICE):
+        """
+        sensor_row: các cột của sensor_data trừ stored_us (điền sau commit),
+        led_row: (led1, led2). Trả về False nếu bản ghi bị bỏ.
+        """
+        item = (tuple(sensor_row), tuple(led_row), device)
+        with self._cond:
+            if len(self._queue) >= self.max_queue and self.overflow == "block":
+                deadline = time.monotonic() + self.block_timeout
+                while len(self._queue) >= self.max_queue and not self._stopping:
+                    remaining = deadline - time.monotonic()
+                    if remaining <= 0:
+                        break
+                    self._cond.wait(remaining)
+            if len(self._queue) < self.max_queue:
+                self._queue.append(item)
+                self._enqueued += 1
+                if len(self._queue) >= self.batch_size:
+                    self._cond.notify_all()
+                return True
+            if self.overflow != "spool":
+                self._dropped += 1
+                return False
+        self._spool([item])
+        return True
+
+    def flush(self):
+        """Đánh thức luồng flush ngay, không chờ đủ lô."""
+        with self._cond:
+            self._cond.notify_all()
+
+    def close(self, timeout=10.0):
+        """Dừng luồng flush sau khi ghi nốt hàng đợi."""
+        with self._cond:
+            self._stopping = True
+            self._cond.notify_all()
+        if self._thread:
+            self._thread.join(timeout)
+
+    def _run(self):
+        while True:
+            with self._cond:
+                deadline = time.monotonic() + self.flush_interval
+                while (len(self._queue) < self.batch_size and not self._stopping
+                       and self._retry is None):
+                    remaining = deadline - time.monotonic()
+                    if remaining <= 0:
+                        break
+                    self._cond.wait(remaining)
+                if self._retry is not None:
+                    batch, self._retry = self._retry, None
+                else:
+                    batch = [self._queue.popleft()
+                             for _ in range(min(self.batch_size, len(self._queue)))]
+                    self._cond.notify_all()   # Chỗ trống cho người gọi put() đang chờ
+                stopping = self._stopping
+                drained = not self._queue
+
+            pending = self._store(batch) if batch else []
+            if pending:
+                if self.spool_path:
+                    self._spool(pending)
+                elif stopping:
+                    with self._cond:
+                        self._dropped += len(pending)
+                else:
+                    self._retry = pending
+                    time.sleep(self.flush_interval)   # Chờ CSDL hồi lại rồi thử lại
+            elif self.spool_path and not stopping:
+                self._replay()
+
+            if stopping and drained and self._retry is None:
+                return
+
+    def _store(self, batch):
+        """Ghi lô; trả về phần (đuôi của lô) chưa ghi được vì mất kết nối."""
+        error = self._write(batch)
+        if error is None:
+            return []
+        if isinstance(error, TRANSIENT_ERRORS):
+            return batch
+        if len(batch) == 1:
+            self._reject(batch[0], error)
+            return []
+        mid = len(batch) // 2
+        pending = self._store(batch[:mid])
+        if pending:
+            return pending + batch[mid:]
+        return self._store(batch[mid:])
+
+    def _reject(self, item, error):
+        print(f"[INGEST] Bỏ bản ghi lỗi dữ liệu {item}: {error}")
+        with self._cond:
+            self._rejected += 1
+        if self.spool_path:
+            s, l, d = item
+            with self._spool_lock:
+                with open(self.spool_path + ".rejected", "a", encoding="utf-8") as f:
+                    f.write(json.dumps({"s": s, "l": l, "d": d, "error": str(error)},
+                                       default=str) + "\n")
+
+    def _write(self, batch):
+        """None nếu đã commit, ngược lại là exception làm lô thất bại."""
+        start = time.monotonic()
+        # Lô thử lại hoặc nạp lại từ spool giữ thời điểm nhận của từng bản ghi
+        flushed_at = datetime.now().replace(microsecond=0)
+        times = [row_time(s, flushed_at) for s, _, _ in batch]
+        try:
+            with self.pool.connection() as db:
+                cursor = db.cursor()
+                try:
+                    db.begin()
+                    cursor.executemany(SENSOR_INSERT,
+                                       [s + (None, ts) for (s, _, _), ts in zip(batch, times)])
+                    first_id = cursor.lastrowid
+                    cursor.executemany(LED_INSERT, [l + (ts,) for (_, l, _), ts in zip(batch, times)])
+                    for table, width in ROLLUPS.items():
+                        cursor.executemany(ROLLUP_UPSERTS[table],
+                                           rollup_rows(width, batch, times))
+                    db.commit()
+                finally:
+                    cursor.close()
+        except Exception as e:
+            with self._cond:
+                self._errors += 1
+                self._last_error = str(e)
+            print(f"[INGEST] Ghi lô {len(batch)} bản ghi thất bại: {e}")
+            return e
+
+        # Lô đã commit: lỗi từ đây không được trả về False, nếu không sẽ ghi trùng
+        stored_us = now_us()
+        # Bản ghi cuối của từng thiết bị trong lô
+        last = {d: (s, l, ts) for (s, l, d), ts in zip(batch, times)}
+        if self.on_stored:
+            for d, (s, _, _) in last.items():
+                self.on_stored(d, s[9], stored_us)
+        try:
+            with self.pool.connection() as db:
+                cursor = db.cursor()
+                try:
+                    cursor.execute(STORED_UPDATE, (stored_us, first_id, first_id + len(batch) - 1,
+                                                   min(times), max(times)))
+                    cursor.executemany(LATEST_UPSERT, [
+                        (d,) + s + (stored_us, ts) + l for d, (s, l, ts) in last.items()])
+                finally:
+                    cursor.close()
+        except Exception as e:
+            with self._cond:
+                self._errors += 1
+                self._last_error = str(e)
+            print(f"[INGEST] Điền stored_us cho lô {len(batch)} bản ghi thất bại: {e}")
+
+        now = time.monotonic()
+        elapsed = now - start
+        with self._cond:
+            self._batches += 1
+            self._flushed_rows += len(batch)
+            self._flush_s += elapsed
+            self._flush_max_s = max(self._flush_max_s, elapsed)
+            self._recent.append((now, len(batch)))
+            while self._recent and now - self._recent[0][0] > RATE_WINDOW_S:
+                self._recent.popleft()
+        return None
+
+    def _spool(self, items):
+        lines = "".join(json.dumps({"s": s, "l": l, "d": d}) + "\n" for s, l, d in items)
+        with self._spool_lock:
+            with open(self.spool_path, "a", encoding="utf-8") as f:
+                f.write(lines)
+                f.flush()
+                os.fsync(f.fileno())
+        with self._cond:
+            self._spooled += len(items)
+
+    def _replay(self):
+        # Đổi tên trước khi đọc: put() vẫn có thể ghi tiếp vào spool_path mới
+        replay_path = self.spool_path + ".replay"
+        with self._spool_lock:
+            if not os.path.exists(replay_path):
+                if not os.path.exists(self.spool_path):
+                    return
+                os.replace(self.spool_path, replay_path)
+
+        with open(replay_path, encoding="utf-8") as f:
+            items = [(tuple(r["s"]), tuple(r["l"]), r.get("d", DEFAULT_DEVICE))
+                     for r in (json.loads(line) for line in f if line.strip())]
+        for i in range(0, len(items), self.batch_size):
+            batch = items[i:i + self.batch_size]
+            pending = self._store(batch)
+            if pending:
+                # Giữ phần chưa ghi trong file replay cho lần sau
+                with self._spool_lock:
+                    with open(replay_path, "w", encoding="utf-8") as f:
+                        f.writelines(json.dumps({"s": s, "l": l, "d": d}) + "\n"
+                                     for s, l, d in pending + items[i + len(batch):])
+                return
+            with self._cond:
+                self._replayed += len(batch)
+        os.remove(replay_path)
+
+    def metrics(self):
+        now = time.monotonic()
+        with self._cond:
+            recent = [n for t, n in self._recent if now - t <= RATE_WINDOW_S]
+            window = min(RATE_WINDOW_S, now - self._started)
+            batches = self._batches
+            return {
+                "queued": len(self._queue) + (len(self._retry) if self._retry else 0),
+                "max_queue": self.max_queue,
+                "overflow": self.overflow,
+                "enqueued": self._enqueued,
+                "flushed_rows": self._flushed_rows,
+                "batches": batches,
+                "avg_batch": round(self._flushed_rows / batches, 1) if batches else 0.0,
+                "flush_ms_avg": round(self._flush_s * 1000 / batches, 3) if batches else 0.0,
+                "flush_ms_max": round(self._flush_max_s * 1000, 3),
+                "rows_per_s": round(sum(recent) / window, 1) if window > 0 else 0.0,
+                "dropped": self._dropped,
+                "spooled": self._spooled,
+                "replayed": self._replayed,
+                "rejected": self._rejected,
+                "errors": self._errors,
+                "last_error": self._last_error,
+            }
@@ -0,0 +1,84 @@
+import threading
+import time
+
+STALE_AFTER_S = 15.0      # App publish mỗi ~5 s: quá 3 chu kỳ không có tin là cũ
+
+
+class LatestState:
+    """
+    Trạng thái mới nhất của từng thiết bị, cập nhật trực tiếp từ MQTT để
+    /api/latest không phải hỏi CSDL. Chỉ nạp từ bảng latest_state một lần
+    lúc khởi động lạnh (load_rows).
+    """
+
+    def __init__(self, stale_after=STALE_AFTER_S):
+        self.stale_after = stale_after
+        self._lock = threading.Lock()
+        self._devices = {}
+        self._newest = None       # Thiết bị có bản tin gần nhất
+        self.loaded = False
+
+    def update_reading(self, device, reading, received_at=None):
+        """reading: các cột như latest_state (temperature, ..., led1, led2)."""
+        received_at = received_at if received_at is not None else time.time()
+        with self._lock:
+            state = self._devices.setdefault(device, {})
+            state.update(reading)
+            state["received_at"] = received_at
+            self._newest = device
+
+    def mark_stored(self, device, recv_us, stored_us):
+        """Ingest đã commit bản tin recv_us; bỏ qua nếu đã có bản tin mới hơn."""
+        with self._lock:
+            state = self._devices.get(device)
+            if state is not None and state.get("recv_us") == recv_us:
+                state["stored_us"] = stored_us
+
+    def update_led(self, led1, led2, device=None):
+        """Lệnh LED phát cho mọi thiết bị, trừ khi chỉ rõ device."""
+        with self._lock:
+            targets = [device] if device else list(self._devices)
+            for name in targets:
+                state = self._devices.setdefault(name, {})
+                state["led1"] = led1
+                state["led2"] = led2
+
+    def led1(self, device):
+        with self._lock:
+            state = self._devices.get(device)
+            return state.get("led1") if state else None
+
+    def get(self, device=None):
+        """Bản sao trạng thái của device (mặc định: thiết bị gửi tin gần nhất)."""
+        with self._lock:
+            device = device or self._newest
+            state = self._devices.get(device)
+            if state is None or "received_at" not in state:
+                return None
+            snapshot = dict(state, device=device)
+        age = time.time() - snapshot["received_at"]
+        snapshot["age_s"] = round(age, 3)
+        snapshot["stale"] = age > self.stale_after
+        return snapshot
+
+    def devices(self):
+        with self._lock:
+            return sorted(self._devices)
+
+    def load_rows(self, rows):
+        """Khởi động lạnh từ các dòng của bảng latest_state; tin MQTT mới hơn được giữ lại."""
+        with self._lock:
+            for row in rows:
+                device = row.pop("device")
+                if device in self._devices:
+                    continue
+                ts = row.get("timestamp")
+                state = dict(row)
+                if ts is not None:
+                    state["received_at"] = ts.timestamp()
+                self._devices[device] = state
+                if ts is not None and (
+                        self._newest is None
+                        or state["received_at"] > self._devices[self._newest].get("received_at", 0)):
+                    self._newest = device
+            self.loaded = True
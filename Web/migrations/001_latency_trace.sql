@@ -0,0 +1,13 @@
+USE sensor_system;
+-- Mốc thời gian từng chặng (µs, epoch) để đo độ trễ từ driver tới dashboard.
+-- *_acq_us: driver lấy mẫu, read_us: app đọc xong, pub_us: app publish,
+-- recv_us: backend nhận MQTT, stored_us: backend ghi vào CSDL.
+ALTER TABLE sensor_data
+    ADD COLUMN bh1750_seq INT UNSIGNED NULL,
+    ADD COLUMN bh1750_acq_us BIGINT NULL,
+    ADD COLUMN dht11_seq INT UNSIGNED NULL,
+    ADD COLUMN dht11_acq_us BIGINT NULL,
+    ADD COLUMN read_us BIGINT NULL,
+    ADD COLUMN pub_us BIGINT NULL,
+    ADD COLUMN recv_us BIGINT NULL,
+    ADD COLUMN stored_us BIGINT NULL;
@@ -0,0 +1,40 @@
+USE sensor_system;
+-- Index theo thời gian cho các truy vấn "mới nhất"/theo khoảng thời gian,
+-- và bảng latest_state giữ sẵn bản ghi mới nhất để /api/latest chỉ cần
+-- tra theo khóa chính thay vì JOIN tương quan trên toàn bảng.
+ALTER TABLE sensor_data ADD INDEX idx_sensor_timestamp (timestamp);
+ALTER TABLE led_status ADD INDEX idx_led_timestamp (timestamp);
+
+-- Một dòng cho mỗi thiết bị; ingest.py ghi bằng kết nối riêng ngay sau khi lô
+-- sensor_data/led_status commit (cùng lúc điền stored_us), không cùng transaction
+CREATE TABLE latest_state (
+    device VARCHAR(32) NOT NULL PRIMARY KEY,
+    temperature FLOAT NULL,
+    humidity FLOAT NULL,
+    lux FLOAT NULL,
+    timestamp DATETIME NULL,
+    bh1750_seq INT UNSIGNED NULL,
+    bh1750_acq_us BIGINT NULL,
+    dht11_seq INT UNSIGNED NULL,
+    dht11_acq_us BIGINT NULL,
+    read_us BIGINT NULL,
+    pub_us BIGINT NULL,
+    recv_us BIGINT NULL,
+    stored_us BIGINT NULL,
+    led1 VARCHAR(3) NOT NULL DEFAULT 'OFF',
+    led2 VARCHAR(3) NOT NULL DEFAULT 'OFF',
+    led_timestamp DATETIME NULL
+);
+
+-- Khởi tạo từ dữ liệu đã có
+INSERT INTO latest_state
+    (device, temperature, humidity, lux, timestamp,
+     bh1750_seq, bh1750_acq_us, dht11_seq, dht11_acq_us,
+     read_us, pub_us, recv_us, stored_us, led1, led2, led_timestamp)
+SELECT 'default', s.temperature, s.humidity, s.lux, s.timestamp,
+       s.bh1750_seq, s.bh1750_acq_us, s.dht11_seq, s.dht11_acq_us,
+       s.read_us, s.pub_us, s.recv_us, s.stored_us,
+       COALESCE(l.led1, 'OFF'), COALESCE(l.led2, 'OFF'), l.timestamp
+FROM (SELECT 1) one
+LEFT JOIN (SELECT * FROM sensor_data ORDER BY id DESC LIMIT 1) s ON TRUE
+LEFT JOIN (SELECT * FROM led_status ORDER BY id DESC LIMIT 1) l ON TRUE;
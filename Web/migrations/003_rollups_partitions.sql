@@ -0,0 +1,63 @@
+USE sensor_system;
+-- Rollup theo phút/giờ cho lịch sử khoảng dài, và chia sensor_data/led_status
+-- thành partition theo ngày để xóa dữ liệu cũ bằng DROP PARTITION.
+-- Partition ngày mới và việc xóa partition hết hạn do retention.py trong backend làm.
+
+-- Mỗi bucket giữ tổng/min/max; trung bình = *_sum / samples
+CREATE TABLE sensor_rollup_1m (
+    bucket DATETIME NOT NULL PRIMARY KEY,  -- Đầu phút
+    samples INT UNSIGNED NOT NULL,
+    temperature_sum DOUBLE NOT NULL,
+    temperature_min FLOAT NOT NULL,
+    temperature_max FLOAT NOT NULL,
+    humidity_sum DOUBLE NOT NULL,
+    humidity_min FLOAT NOT NULL,
+    humidity_max FLOAT NOT NULL,
+    lux_sum DOUBLE NOT NULL,
+    lux_min FLOAT NOT NULL,
+    lux_max FLOAT NOT NULL
+);
+CREATE TABLE sensor_rollup_1h LIKE sensor_rollup_1m;  -- bucket = đầu giờ
+
+INSERT INTO sensor_rollup_1m
+SELECT DATE_FORMAT(timestamp, '%Y-%m-%d %H:%i:00'), COUNT(*),
+       SUM(temperature), MIN(temperature), MAX(temperature),
+       SUM(humidity), MIN(humidity), MAX(humidity),
+       SUM(lux), MIN(lux), MAX(lux)
+FROM sensor_data
+WHERE timestamp IS NOT NULL
+GROUP BY 1;
+
+INSERT INTO sensor_rollup_1h
+SELECT DATE_FORMAT(bucket, '%Y-%m-%d %H:00:00'), SUM(samples),
+       SUM(temperature_sum), MIN(temperature_min), MAX(temperature_max),
+       SUM(humidity_sum), MIN(humidity_min), MAX(humidity_max),
+       SUM(lux_sum), MIN(lux_min), MAX(lux_max)
+FROM sensor_rollup_1m
+GROUP BY 1;
+
+-- Cột partition phải NOT NULL và nằm trong mọi khóa duy nhất
+UPDATE sensor_data SET timestamp = COALESCE(FROM_UNIXTIME(recv_us / 1000000), NOW())
+WHERE timestamp IS NULL;
+UPDATE led_status SET timestamp = NOW() WHERE timestamp IS NULL;
+ALTER TABLE sensor_data
+    MODIFY timestamp DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    DROP PRIMARY KEY,
+    ADD PRIMARY KEY (id, timestamp);
+ALTER TABLE led_status
+    MODIFY timestamp DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    DROP PRIMARY KEY,
+    ADD PRIMARY KEY (id, timestamp);
+
+-- Dữ liệu tới hết hôm nay vào p_start; từ ngày mai retention.py tách p_future
+-- thành partition từng ngày (pYYYYMMDD). p_start bị xóa khi cả khối đã quá hạn.
+SET @p_start = TO_DAYS(CURDATE() + INTERVAL 1 DAY);
+SET @sql = CONCAT('ALTER TABLE sensor_data PARTITION BY RANGE (TO_DAYS(timestamp)) (',
+                  'PARTITION p_start VALUES LESS THAN (', @p_start, '), ',
+                  'PARTITION p_future VALUES LESS THAN MAXVALUE)');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+SET @sql = REPLACE(@sql, 'sensor_data', 'led_status');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;
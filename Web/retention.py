@@ -0,0 +1,133 @@
+import threading
+from datetime import date, datetime, timedelta
+
+# Bảng dữ liệu gốc chia partition theo ngày (migrations/003_rollups_partitions.sql)
+PARTITIONED_TABLES = ("sensor_data", "led_status")
+FUTURE_PARTITION = "p_future"
+DELETE_CHUNK = 10000
+
+
+def to_days(d):
+    """Giống TO_DAYS() của MySQL."""
+    return d.toordinal() + 365
+
+
+def from_days(n):
+    return date.fromordinal(n - 365)
+
+
+def partition_bounds(db, table):
+    """[(tên partition, TO_DAYS cận trên)] theo thứ tự, bỏ p_future (MAXVALUE)."""
+    rows = db.query("""
+        SELECT PARTITION_NAME AS name, PARTITION_DESCRIPTION AS bound
+        FROM information_schema.PARTITIONS
+        WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = %s AND PARTITION_NAME IS NOT NULL
+        ORDER BY PARTITION_ORDINAL_POSITION
+    """, (table,))
+    return [(row['name'], int(row['bound'])) for row in rows if row['bound'] != 'MAXVALUE']
+
+
+def ensure_partitions(db, table, today, days_ahead):
+    """Tách p_future thành partition từng ngày tới hết today + days_ahead."""
+    bounds = partition_bounds(db, table)
+    if not bounds:
+        return []
+    day = from_days(bounds[-1][1])
+    last = today + timedelta(days=days_ahead)
+    created = []
+    while day <= last:
+        created.append(f"PARTITION p{day:%Y%m%d} VALUES LESS THAN ({to_days(day + timedelta(days=1))})")
+        day += timedelta(days=1)
+    if created:
+        # p_future rỗng nên REORGANIZE không phải chép dữ liệu
+        cursor = db.cursor()
+        try:
+            cursor.execute(
+                f"ALTER TABLE {table} REORGANIZE PARTITION {FUTURE_PARTITION} INTO ("
+                + ", ".join(created)
+                + f", PARTITION {FUTURE_PARTITION} VALUES LESS THAN MAXVALUE)")
+        finally:
+            cursor.close()
+    return [c.split()[1] for c in created]
+
+
+def drop_expired(db, table, today, keep_days):
+    """Xóa các partition mà toàn bộ dữ liệu cũ hơn keep_days ngày."""
+    cutoff = to_days(today - timedelta(days=keep_days))
+    expired = [name for name, bound in partition_bounds(db, table) if bound <= cutoff]
+    if expired:
+        cursor = db.cursor()
+        try:
+            cursor.execute(f"ALTER TABLE {table} DROP PARTITION {', '.join(expired)}")
+        finally:
+            cursor.close()
+    return expired
+
+
+def purge_rollup(db, table, before):
+    """Rollup không chia partition: xóa theo khóa chính từng đợt nhỏ."""
+    deleted = 0
+    while True:
+        cursor = db.execute(f"DELETE FROM {table} WHERE bucket < %s LIMIT {DELETE_CHUNK}", (before,))
+        deleted += cursor.rowcount
+        if cursor.rowcount < DELETE_CHUNK:
+            return deleted
+
+
+class RetentionJob:
+    """
+    Chạy định kỳ trong backend: tạo trước partition cho các ngày tới, xóa
+    partition dữ liệu gốc quá raw_keep_days và rollup 1 phút quá
+    rollup_1m_keep_days. Rollup 1 giờ giữ vĩnh viễn.
+    """
+
+    def __init__(self, pool, raw_keep_days=30, rollup_1m_keep_days=180,
+                 days_ahead=7, interval=3600):
+        self.pool = pool
+        self.raw_keep_days = raw_keep_days
+        self.rollup_1m_keep_days = rollup_1m_keep_days
+        self.days_ahead = days_ahead
+        self.interval = interval
+        self._stop = threading.Event()
+        self._lock = threading.Lock()
+        self._last = {}
+
+    def start(self):
+        threading.Thread(target=self._run, name="retention", daemon=True).start()
+
+    def stop(self):
+        self._stop.set()
+
+    def _run(self):
+        while not self._stop.is_set():
+            try:
+                self.run_once()
+            except Exception as e:
+                with self._lock:
+                    self._last = {"error": str(e), "at": datetime.now().strftime('%Y-%m-%d %H:%M:%S')}
+                print(f"[RETENTION] Lỗi: {e}")
+            self._stop.wait(self.interval)
+
+    def run_once(self):
+        today = date.today()
+        result = {"at": datetime.now().strftime('%Y-%m-%d %H:%M:%S'), "created": {}, "dropped": {}}
+        with self.pool.connection() as db:
+            for table in PARTITIONED_TABLES:
+                result["created"][table] = ensure_partitions(db, table, today, self.days_ahead)
+                result["dropped"][table] = drop_expired(db, table, today, self.raw_keep_days)
+            result["rollup_1m_deleted"] = purge_rollup(
+                db, "sensor_rollup_1m",
+                datetime.combine(today - timedelta(days=self.rollup_1m_keep_days), datetime.min.time()))
+        if any(result["created"].values()) or any(result["dropped"].values()):
+            print(f"[RETENTION] {result}")
+        with self._lock:
+            self._last = result
+        return result
+
+    def metrics(self):
+        with self._lock:
+            return {
+                "raw_keep_days": self.raw_keep_days,
+                "rollup_1m_keep_days": self.rollup_1m_keep_days,
+                "last_run": self._last,
+            }